@@ -36,24 +36,44 @@ void DirectoryWalker::Traverse(const bool descend = false) {
           continue;
         }
 
-        Queue.push(new boost::filesystem::path(entry));
+        // Capture the size now while we are already looking at the entry, so
+        // that work can be scheduled by cost later.
+        Push(entry.path());
       }
     }
     Completed = true;
   });
 }
 
-std::pair<std::optional<boost::filesystem::path>, bool>
-DirectoryWalker::GetNext() {
-  boost::filesystem::path *entry;
+void DirectoryWalker::Enqueue(
+    const std::vector<boost::filesystem::path> &files) {
+  for (auto &file : files)
+    Push(file);
+  Completed = true;
+}
+
+void DirectoryWalker::Push(const boost::filesystem::path &path) {
+  boost::system::error_code ec;
+  uintmax_t size = boost::filesystem::file_size(path, ec);
+  if (ec)
+    size = 0;
+
+  Queue.push(new DirectoryEntry{path, size});
+}
+
+std::pair<std::optional<DirectoryEntry>, bool> DirectoryWalker::GetNext() {
+  // Read the completion flag before popping. If traversal had already
+  // completed and the pop fails, the queue really is empty.
+  bool completed = Completed;
+  DirectoryEntry *entry;
   bool success = Queue.pop(entry);
 
   if (!success)
-    return {std::nullopt, Completed};
+    return {std::nullopt, completed};
 
-  auto retval = boost::filesystem::path(*entry);
+  auto retval = DirectoryEntry(*entry);
   delete entry;
-  return {retval, Completed};
+  return {retval, completed};
 }
 
 void DirectoryWalker::Finish() {
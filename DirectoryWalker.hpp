@@ -1,7 +1,18 @@
+#pragma once
+
+#include <atomic>
 #include <boost/filesystem.hpp>
 #include <boost/lockfree/queue.hpp>
 #include <optional>
 #include <thread>
+#include <vector>
+
+// A file found during traversal, along with its size in bytes (0 if it could
+// not be determined). The size is used as a cheap estimate of processing cost.
+struct DirectoryEntry {
+  boost::filesystem::path Path;
+  uintmax_t Size;
+};
 
 class DirectoryWalker {
 public:
@@ -11,23 +22,30 @@ public:
   // Directory entries can immediately be retrieved using GetNext();
   void Traverse(const bool descend);
 
+  // Alternative to Traverse() which hands out the given files rather than
+  // the contents of the directory.
+  void Enqueue(const std::vector<boost::filesystem::path> &files);
+
   // GetNext returns a pair of values -
-  // an optional next path that has been retrieved from filesystem
+  // an optional next entry that has been retrieved from filesystem
   // traversal, and a bool indicating if the overall traversal process
   // has completed or not.
-  std::pair<std::optional<boost::filesystem::path>, bool> GetNext();
+  std::pair<std::optional<DirectoryEntry>, bool> GetNext();
 
   // Ensures the asynchronous worker has completed before returning.
   void Finish();
 
 private:
+  // Queue a file, along with its size
+  void Push(const boost::filesystem::path &path);
+
   boost::filesystem::path Directory;
-  boost::lockfree::queue<boost::filesystem::path *,
+  boost::lockfree::queue<DirectoryEntry *,
                          boost::lockfree::fixed_sized<false>>
       Queue;
 
   // Semaphore indicating that directory traversal has completed
-  bool Completed = false;
+  std::atomic<bool> Completed = false;
 
   // Reference to thread running the directory traversal
   std::thread Worker;
@@ -0,0 +1,144 @@
+#include "DirectoryWatcher.hpp"
+#include <iostream>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+DirectoryWatcher::DirectoryWatcher(const std::string directoryName)
+    : Directory(directoryName) {}
+
+DirectoryWatcher::~DirectoryWatcher() {
+  if (Fd >= 0)
+    close(Fd);
+}
+
+void DirectoryWatcher::Exclude(const std::string directoryName) {
+  boost::system::error_code ec;
+  // Destination directories are usually given with a trailing separator
+  auto directory =
+      boost::filesystem::path(directoryName).remove_trailing_separator();
+  Excluded = boost::filesystem::weakly_canonical(directory, ec);
+  if (ec)
+    Excluded.clear();
+}
+
+bool DirectoryWatcher::IsExcluded(
+    const boost::filesystem::path directory) const {
+  if (Excluded.empty())
+    return false;
+
+  boost::system::error_code ec;
+  auto canonical = boost::filesystem::weakly_canonical(directory, ec);
+  return !ec && canonical == Excluded;
+}
+
+void DirectoryWatcher::SetRescanFilter(
+    std::function<bool(const boost::filesystem::path &)> filter) {
+  RescanFilter = filter;
+}
+
+void DirectoryWatcher::Watch() {
+  Fd = inotify_init1(IN_CLOEXEC);
+  if (Fd < 0)
+    throw std::runtime_error("unable to initialise inotify");
+
+  AddWatches(Directory, nullptr);
+}
+
+void DirectoryWatcher::AddWatches(
+    const boost::filesystem::path directory,
+    const std::function<bool(const boost::filesystem::path &)> &collect) {
+  // Files written to the excluded directory would otherwise come straight
+  // back as changes. The top of the tree is still watched for everything
+  // else in it.
+  bool excluded = IsExcluded(directory);
+  if (excluded && directory != Directory)
+    return;
+
+  // IN_CLOSE_WRITE rather than IN_CREATE/IN_MODIFY, so that we only see
+  // files once they have been completely written.
+  int wd = inotify_add_watch(Fd, directory.c_str(),
+                             IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                 IN_ONLYDIR);
+  if (wd < 0) {
+    std::cerr << "unable to watch " << directory << std::endl;
+    return;
+  }
+  Watches[wd] = directory;
+  if (excluded)
+    ExcludedWatch = wd;
+
+  boost::system::error_code ec;
+  for (auto &entry : boost::filesystem::directory_iterator(directory, ec)) {
+    if (boost::filesystem::is_directory(entry)) {
+      AddWatches(entry.path(), collect);
+      continue;
+    }
+
+    if (collect && !excluded && collect(entry.path()))
+      Changed.insert(entry.path());
+  }
+}
+
+bool DirectoryWatcher::ReadEvents(const int timeoutMs) {
+  pollfd pfd = {Fd, POLLIN, 0};
+  if (poll(&pfd, 1, timeoutMs) <= 0)
+    return false;
+
+  alignas(inotify_event) char buffer[65536];
+  ssize_t length = read(Fd, buffer, sizeof(buffer));
+  if (length <= 0)
+    return false;
+
+  auto all = [](const boost::filesystem::path &) { return true; };
+  for (char *p = buffer; p < buffer + length;) {
+    auto *event = reinterpret_cast<inotify_event *>(p);
+    p += sizeof(inotify_event) + event->len;
+
+    // Events were dropped, so we can't know what changed. Rescan the tree,
+    // leaving it to the filter to pick out what actually needs redoing.
+    if (event->mask & IN_Q_OVERFLOW) {
+      std::cerr << "inotify queue overflowed, rescanning " << Directory
+                << std::endl;
+      AddWatches(Directory, RescanFilter ? RescanFilter : all);
+      continue;
+    }
+
+    if (event->mask & IN_IGNORED) {
+      Watches.erase(event->wd);
+      continue;
+    }
+
+    auto watch = Watches.find(event->wd);
+    if (watch == Watches.end() || event->len == 0)
+      continue;
+
+    boost::filesystem::path path = watch->second / event->name;
+    if (event->mask & IN_ISDIR) {
+      // New directories (created or moved in) need watching too
+      AddWatches(path, all);
+      continue;
+    }
+
+    // Plain creation is followed by IN_CLOSE_WRITE once the file is written
+    if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+        event->wd != ExcludedWatch)
+      Changed.insert(path);
+  }
+  return true;
+}
+
+std::vector<boost::filesystem::path>
+DirectoryWatcher::WaitForChanges(const std::chrono::milliseconds quietPeriod) {
+  // Wait for the first change
+  while (Changed.empty())
+    ReadEvents(-1);
+
+  // Coalesce until things settle down
+  while (ReadEvents(quietPeriod.count()))
+    ;
+
+  std::vector<boost::filesystem::path> changed(Changed.begin(), Changed.end());
+  Changed.clear();
+  return changed;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+// Watches a directory tree for new and changed files using inotify.
+class DirectoryWatcher {
+public:
+  DirectoryWatcher(const std::string directoryName);
+  ~DirectoryWatcher();
+
+  // Leave out a directory inside the tree, and everything below it, e.g.
+  // where fingerprints are being written. Must be called before Watch().
+  void Exclude(const std::string directoryName);
+
+  // Decides which existing files are picked up when the tree has to be
+  // rescanned because events were lost. Without one, every file is.
+  void SetRescanFilter(
+      std::function<bool(const boost::filesystem::path &)> filter);
+
+  // Subscribe to changes across the whole tree. Should be called before any
+  // initial scan so that files written during the scan aren't missed.
+  void Watch();
+
+  // Blocks until at least one file has been written, then keeps collecting
+  // events until the tree has been quiet for the given period, so that a
+  // burst of writes is returned as one batch. Each file appears once.
+  std::vector<boost::filesystem::path>
+  WaitForChanges(const std::chrono::milliseconds quietPeriod);
+
+private:
+  // Add watches for a directory and everything below it. Files already in
+  // newly watched directories for which collect returns true are added to the
+  // changed set, as they may have been written before the watch was in place.
+  // An empty collect adds none.
+  void AddWatches(
+      const boost::filesystem::path directory,
+      const std::function<bool(const boost::filesystem::path &)> &collect);
+
+  // Read and handle all pending events. Returns false if none were ready
+  // within the timeout.
+  bool ReadEvents(const int timeoutMs);
+
+  // Whether a directory is the excluded one
+  bool IsExcluded(const boost::filesystem::path directory) const;
+
+  boost::filesystem::path Directory;
+  boost::filesystem::path Excluded; // canonical, empty if none
+  int ExcludedWatch = -1; // if the excluded directory is the top of the tree
+  int Fd = -1;
+
+  // Watch descriptor to directory
+  std::map<int, boost::filesystem::path> Watches;
+
+  std::set<boost::filesystem::path> Changed;
+
+  std::function<bool(const boost::filesystem::path &)> RescanFilter;
+};
@@ -0,0 +1,111 @@
+#include "FingerprintFormat.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+
+std::string FingerprintFormat::ToString() const {
+  std::stringstream s;
+  s << Size << "x" << Size << " ";
+  switch (Layout) {
+  case ChannelLayout::RGB:
+    s << "rgb";
+    break;
+  case ChannelLayout::Gray:
+    s << "gray";
+    break;
+  case ChannelLayout::LumaChroma:
+    s << "yuv420";
+    break;
+  }
+  return s.str();
+}
+
+std::optional<FingerprintFormat>
+FingerprintFormat::Parse(const std::string geometry, const std::string layout) {
+  FingerprintFormat format;
+
+  // Accept "32" or "32x32"
+  auto x = geometry.find('x');
+  try {
+    format.Size = std::stoi(geometry.substr(0, x));
+    if (x != std::string::npos && std::stoi(geometry.substr(x + 1)) != format.Size)
+      return std::nullopt;
+  } catch (const std::exception &e) {
+    return std::nullopt;
+  }
+
+  bool supported = false;
+  for (int size : SupportedSizes)
+    supported |= size == format.Size;
+  if (!supported)
+    return std::nullopt;
+
+  if (layout == "rgb")
+    format.Layout = ChannelLayout::RGB;
+  else if (layout == "gray")
+    format.Layout = ChannelLayout::Gray;
+  else if (layout == "yuv420")
+    format.Layout = ChannelLayout::LumaChroma;
+  else
+    return std::nullopt;
+
+  return format;
+}
+
+FingerprintFormat FingerprintFormat::Read(const std::string directory) {
+  boost::filesystem::path path(directory);
+  path /= MetadataFilename;
+
+  std::ifstream in(path.string());
+  std::string geometry, layout;
+  if (!(in >> geometry >> layout))
+    return FingerprintFormat();
+
+  auto format = Parse(geometry, layout);
+  if (!format.has_value())
+    throw std::runtime_error("unsupported fingerprint format in " +
+                             path.string());
+  return format.value();
+}
+
+void FingerprintFormat::Write(const std::string directory) const {
+  boost::filesystem::path path(directory);
+  path /= MetadataFilename;
+
+  std::ofstream out(path.string());
+  out << ToString() << std::endl;
+}
+
+template <int Size>
+static FingerprintComparator comparatorFor(const ChannelLayout layout) {
+  switch (layout) {
+  case ChannelLayout::Gray:
+    return {FingerprintKernel<Size, ChannelLayout::Gray>::Length,
+            FingerprintKernel<Size, ChannelLayout::Gray>::Distance,
+            FingerprintKernel<Size, ChannelLayout::Gray>::Extract};
+  case ChannelLayout::LumaChroma:
+    return {FingerprintKernel<Size, ChannelLayout::LumaChroma>::Length,
+            FingerprintKernel<Size, ChannelLayout::LumaChroma>::Distance,
+            FingerprintKernel<Size, ChannelLayout::LumaChroma>::Extract};
+  case ChannelLayout::RGB:
+  default:
+    return {FingerprintKernel<Size, ChannelLayout::RGB>::Length,
+            FingerprintKernel<Size, ChannelLayout::RGB>::Distance,
+            FingerprintKernel<Size, ChannelLayout::RGB>::Extract};
+  }
+}
+
+FingerprintComparator
+FingerprintComparator::For(const FingerprintFormat format) {
+  switch (format.Size) {
+  case 16:
+    return comparatorFor<16>(format.Layout);
+  case 32:
+    return comparatorFor<32>(format.Layout);
+  case 64:
+    return comparatorFor<64>(format.Layout);
+  case 100:
+  default:
+    return comparatorFor<100>(format.Layout);
+  }
+}
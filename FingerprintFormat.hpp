@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Magick++.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// How the pixels of a fingerprint are laid out for comparison.
+enum class ChannelLayout {
+  RGB,       // 3 bytes per pixel
+  Gray,      // luma only, 1 byte per pixel
+  LumaChroma // full resolution luma plus chroma subsampled 2x2 (like 4:2:0)
+};
+
+// Geometry (fingerprints are square) and channel layout of a fingerprint
+// store. Recorded alongside the fingerprints so that a store is always read
+// back the way it was generated.
+struct FingerprintFormat {
+  int Size = 100;
+  ChannelLayout Layout = ChannelLayout::RGB;
+
+  // The geometries with specialised comparison kernels
+  static constexpr int SupportedSizes[] = {16, 32, 64, 100};
+
+  // e.g. "100x100 rgb", as stored in the metadata file
+  std::string ToString() const;
+
+  // Parse a geometry ("32" or "32x32") and a layout ("rgb", "gray" or
+  // "yuv420"). Returns nothing if either isn't supported.
+  static std::optional<FingerprintFormat> Parse(const std::string geometry,
+                                                const std::string layout);
+
+  // Read the format recorded in a fingerprint directory. Directories without
+  // a record are assumed to use the original 100x100 RGB format.
+  static FingerprintFormat Read(const std::string directory);
+
+  // Record the format in a fingerprint directory
+  void Write(const std::string directory) const;
+
+  // Name of the metadata file in the fingerprint directory
+  static constexpr const char *MetadataFilename = ".fingerprint-format";
+
+  // ImageMagick geometry to resize to. ! means ignoring proportions.
+  std::string Geometry() const {
+    return std::to_string(Size) + "x" + std::to_string(Size) + "!";
+  }
+};
+
+// Distance function and pixel extraction for one format, specialised at
+// compile time so that loop bounds are constants and the compiler can unroll
+// and vectorise the comparison.
+template <int Size, ChannelLayout Layout> struct FingerprintKernel {
+  static_assert(Layout != ChannelLayout::LumaChroma || Size % 2 == 0,
+                "chroma subsampling needs an even size");
+
+  static constexpr int Pixels = Size * Size;
+  static constexpr int Length =
+      Layout == ChannelLayout::RGB    ? Pixels * 3
+      : Layout == ChannelLayout::Gray ? Pixels
+                                      : Pixels + 2 * (Pixels / 4);
+
+  // Root mean squared error over all samples, normalised to 0-1, which is
+  // the same scale as ImageMagick's RootMeanSquaredErrorMetric.
+  static double Distance(const uint8_t *a, const uint8_t *b) {
+    uint32_t sum = 0;
+    for (int i = 0; i < Length; i++) {
+      int d = int(a[i]) - int(b[i]);
+      sum += d * d;
+    }
+    return std::sqrt(double(sum) / Length) / 255.0;
+  }
+
+  // Write the pixels of an image (already resized to Size x Size) in this
+  // layout.
+  static void Extract(Magick::Image &image, uint8_t *out) {
+    std::vector<uint8_t> rgb(Pixels * 3);
+    image.write(0, 0, Size, Size, "RGB", MagickCore::CharPixel, rgb.data());
+
+    if constexpr (Layout == ChannelLayout::RGB) {
+      std::copy(rgb.begin(), rgb.end(), out);
+      return;
+    }
+
+    // BT.601 luma, in fixed point
+    for (int i = 0; i < Pixels; i++)
+      out[i] = (77 * rgb[i * 3] + 150 * rgb[i * 3 + 1] +
+                29 * rgb[i * 3 + 2] + 128) >>
+               8;
+
+    if constexpr (Layout == ChannelLayout::LumaChroma) {
+      // Average each 2x2 block, then convert to Cb and Cr
+      uint8_t *cb = out + Pixels;
+      uint8_t *cr = cb + Pixels / 4;
+      for (int y = 0; y < Size; y += 2) {
+        for (int x = 0; x < Size; x += 2) {
+          int r = 0, g = 0, b = 0;
+          for (int p : {y * Size + x, y * Size + x + 1, (y + 1) * Size + x,
+                        (y + 1) * Size + x + 1}) {
+            r += rgb[p * 3];
+            g += rgb[p * 3 + 1];
+            b += rgb[p * 3 + 2];
+          }
+          int block = (y / 2) * (Size / 2) + x / 2;
+          cb[block] = std::min(
+              255, (-43 * r - 85 * g + 128 * b + 4 * 128 * 256 + 512) >> 10);
+          cr[block] = std::min(
+              255, (128 * r - 107 * g - 21 * b + 4 * 128 * 256 + 512) >> 10);
+        }
+      }
+    }
+  }
+};
+
+// Runtime handle on the kernel for a format
+struct FingerprintComparator {
+  int Length;
+  double (*Distance)(const uint8_t *, const uint8_t *);
+  void (*Extract)(Magick::Image &, uint8_t *);
+
+  static FingerprintComparator For(const FingerprintFormat format);
+};
@@ -1,9 +1,14 @@
 #include "DirectoryWalker.hpp"
+#include "DirectoryWatcher.hpp"
+#include "Journal.hpp"
 #include "Util.hpp"
+#include "WorkScheduler.hpp"
 #include <boost/filesystem.hpp>
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 
 #include "FingerprintStore.hpp"
@@ -11,17 +16,23 @@
 FingerprintStore::FingerprintStore(std::string srcDirectory)
     : SrcDirectory(srcDirectory){};
 
-void FingerprintStore::Load() {
+void FingerprintStore::Load() { Load(SrcDirectory); }
+
+void FingerprintStore::Load(const std::string directory) {
+  Format = FingerprintFormat::Read(directory);
+  Comparator = FingerprintComparator::For(Format);
+
   // Start iteration through all files in the directory
-  DirectoryWalker dw(SrcDirectory);
+  DirectoryWalker dw(directory);
   dw.Traverse(true);
 
-  std::cout << "Loading fingerprints into memory..." << std::endl;
+  std::cerr << "Loading " << Format.ToString()
+            << " fingerprints into memory..." << std::endl;
   int loadedCount = 0;
 
   while (true) {
     auto next = dw.GetNext();
-    std::optional<boost::filesystem::path> entry = next.first;
+    std::optional<DirectoryEntry> entry = next.first;
     bool completed = next.second;
 
     // No next value as the directory traversal has completed.
@@ -36,73 +47,225 @@ void FingerprintStore::Load() {
     }
 
     // Filter only known image suffixes
-    if (!Util::IsSupportedImage(entry.value()))
+    if (!Util::IsSupportedImage(entry->Path))
       continue;
 
-    auto filename = entry.value().string();
-    Magick::Image image;
+    // Only load this process's share, if the fingerprints are split
+    if (ShardFingerprints &&
+        !Util::InShard(entry->Path, directory, ShardIndex, ShardCount))
+      continue;
 
-    image.read(filename);
-    Fingerprints.push_back(std::pair(image, entry.value().stem().string()));
+    AddFingerprint(entry->Path.string());
     loadedCount++;
     std::stringstream msg;
     msg << "\r" << loadedCount;
-    std::cout << msg.str() << std::flush;
+    std::cerr << msg.str() << std::flush;
   }
 
   // Wait also on the directory traversal thread to complete.
   dw.Finish();
-  std::cout << "\rDONE\n" << std::flush;
+  std::cerr << "\rDONE\n" << std::flush;
 }
 
-void FingerprintStore::FindMatchesForImage(Magick::Image image,
-                                           const std::string filename,
-                                           const int fuzzFactor) {
-  for (std::vector<std::pair<Magick::Image, std::string>>::iterator it =
-           Fingerprints.begin();
-       it != Fingerprints.end(); ++it) {
+void FingerprintStore::SetFormat(const FingerprintFormat format) {
+  Format = format;
+  Comparator = FingerprintComparator::For(Format);
+}
 
-    // Compare the image to the fingerprint for total number of non-matching
-    // pixels. Distortion will be the pixel count. 100x100 gives a minimum of 0
-    // and max of 10000.
-    image.colorFuzz(fuzzFactor);
-    auto distortion =
-        image.compare(it->first, Magick::RootMeanSquaredErrorMetric);
+void FingerprintStore::SetShard(const int index, const int count,
+                                const bool fingerprints) {
+  ShardIndex = index;
+  ShardCount = count;
+  ShardFingerprints = fingerprints;
+}
 
-    std::stringstream msg;
-    msg << filename;
+void FingerprintStore::AddFingerprint(const std::string filename) {
+  Magick::Image image;
+  image.read(filename);
+  if ((int)image.columns() != Format.Size || (int)image.rows() != Format.Size)
+    image.resize(Format.Geometry());
+  std::vector<uint8_t> pixels = ExtractPixels(image);
+
+  // Pull the fingerprint match name from the fingerprint metadata if
+  // available.
+  std::string stem = boost::filesystem::path(filename).stem().string();
+  std::string name = image.attribute("comment");
+  if (name == "") {
+    name = stem;
+  }
 
-    // Pull the fingerprint match name from the fingerprint metadata if
-    // available.
-    std::string fingerprintName = it->first.attribute("comment");
-    if (fingerprintName == "") {
-      fingerprintName = it->second;
-    }
+  // A fingerprint file which has been regenerated replaces the old version
+  std::unique_lock<std::shared_mutex> lock(FingerprintsMutex);
+  auto existing = FingerprintIndex.find(stem);
+  if (existing != FingerprintIndex.end()) {
+    Fingerprints[existing->second] = std::pair(image, name);
+    std::copy(pixels.begin(), pixels.end(),
+              FingerprintPixels.begin() +
+                  existing->second * Comparator.Length);
+    return;
+  }
+  FingerprintIndex[stem] = Fingerprints.size();
+  Fingerprints.push_back(std::pair(image, name));
+  FingerprintPixels.insert(FingerprintPixels.end(), pixels.begin(),
+                           pixels.end());
+}
 
-    if (distortion < LowDistortionThreshold) {
-      msg << "\tis identical to\t" << fingerprintName << std::endl;
-      std::cout << msg.str() << std::flush;
-      continue;
-    }
+void FingerprintStore::PrepareForComparison(Magick::Image &image) const {
+  image.compressType(
+      MagickCore::CompressionType::NoCompression); // may not be needed
+  image.resize(Format.Geometry());
+}
 
-    if (distortion < HighDistortionThreshold) {
-      msg << "\tis similar to\t" << fingerprintName << std::endl;
-      std::cout << msg.str() << std::flush;
+std::vector<uint8_t>
+FingerprintStore::ExtractPixels(Magick::Image &image) const {
+  std::vector<uint8_t> pixels(Comparator.Length);
+  Comparator.Extract(image, pixels.data());
+  return pixels;
+}
+
+std::string FingerprintStore::FindMatchesForImage(Magick::Image image,
+                                                  const std::string filename,
+                                                  const int fuzzFactor) {
+  std::vector<uint8_t> pixels = ExtractPixels(image);
+  std::stringstream matches;
+  image.colorFuzz(fuzzFactor);
+
+  std::shared_lock<std::shared_mutex> lock(FingerprintsMutex);
+  std::optional<size_t> own = OwnFingerprint(filename);
+  for (size_t i = 0; i < Fingerprints.size(); i++) {
+    if (own == i)
       continue;
+    double distance = CompareToFingerprint(image, pixels.data(), i, fuzzFactor);
+    if (distance < HighDistortionThreshold)
+      matches << filename << "\t" << Describe(distance) << "\t"
+              << Fingerprints[i].second << std::endl;
+  }
+
+  return matches.str();
+}
+
+std::vector<std::vector<Match>> FingerprintStore::FindMatchesForImages(
+    std::vector<std::pair<Magick::Image, std::string>> images,
+    const int fuzzFactor, const double maxDistance) {
+  std::vector<std::vector<Match>> matches(images.size());
+  std::vector<std::vector<uint8_t>> pixels;
+  for (auto &image : images) {
+    image.first.colorFuzz(fuzzFactor);
+    pixels.push_back(ExtractPixels(image.first));
+  }
+
+  std::shared_lock<std::shared_mutex> lock(FingerprintsMutex);
+  for (size_t f = 0; f < Fingerprints.size(); f++) {
+    for (size_t i = 0; i < images.size(); i++) {
+      double distance =
+          CompareToFingerprint(images[i].first, pixels[i].data(), f, fuzzFactor);
+      if (distance < maxDistance)
+        matches[i].push_back({Fingerprints[f].second, distance});
     }
   }
+
+  return matches;
+}
+
+std::string FingerprintStore::Describe(const double distance) const {
+  if (distance < LowDistortionThreshold)
+    return "is identical to";
+  if (distance < HighDistortionThreshold)
+    return "is similar to";
+  return "resembles";
+}
+
+double FingerprintStore::CompareToFingerprint(Magick::Image &image,
+                                              const uint8_t *pixels,
+                                              const size_t index,
+                                              const int fuzzFactor) {
+  // Root mean squared error between the image and the fingerprint. Only
+  // ImageMagick's comparison knows about the fuzz factor, so it is used when
+  // one is set.
+  if (fuzzFactor == 0) {
+    return Comparator.Distance(pixels,
+                               &FingerprintPixels[index * Comparator.Length]);
+  }
+  return image.compare(Fingerprints[index].first,
+                       Magick::RootMeanSquaredErrorMetric);
+}
+
+std::optional<size_t>
+FingerprintStore::OwnFingerprint(const std::string &filename) {
+  if (!SkipOwnFingerprints)
+    return std::nullopt;
+
+  // Fingerprints are named after the image's stem, and record where they were
+  // generated from, which may have been spelled differently.
+  auto image = boost::filesystem::path(filename);
+  auto existing = FingerprintIndex.find(image.stem().string());
+  if (existing == FingerprintIndex.end())
+    return std::nullopt;
+
+  boost::system::error_code ec1, ec2;
+  auto source = boost::filesystem::weakly_canonical(
+      Fingerprints[existing->second].second, ec1);
+  if (ec1 || source != boost::filesystem::weakly_canonical(image, ec2) || ec2)
+    return std::nullopt;
+  return existing->second;
 }
 
 void FingerprintStore::RunWorkers(const WorkerOptions options) {
-  // Start asynchronous traversal of directory.
-  DirectoryWalker *dw;
+  // Fingerprints in one directory must all be in the same format
   if (options.WType == GenerateWorker) {
-    dw = new DirectoryWalker(SrcDirectory);
-  } else {
-    dw = new DirectoryWalker(options.DstDirectory);
+    auto metadata = boost::filesystem::path(options.DstDirectory) /
+                    FingerprintFormat::MetadataFilename;
+    if (boost::filesystem::exists(metadata)) {
+      auto existing = FingerprintFormat::Read(options.DstDirectory);
+      if (existing.ToString() != Format.ToString())
+        throw std::runtime_error(options.DstDirectory + " already contains " +
+                                 existing.ToString() + " fingerprints");
+    }
+    Format.Write(options.DstDirectory);
   }
+
+  // Start asynchronous traversal of directory.
+  std::string root = options.WType == GenerateWorker ? SrcDirectory
+                                                     : options.DstDirectory;
+  DirectoryWalker *dw = new DirectoryWalker(root);
   dw->Traverse(true);
 
+  RunWorkersOn(dw, root, options);
+
+  // Wait also on the directory traversal thread to complete.
+  dw->Finish();
+  delete dw;
+}
+
+void FingerprintStore::RunWorkers(
+    const WorkerOptions options,
+    const std::vector<boost::filesystem::path> &files) {
+  DirectoryWalker dw("");
+  dw.Enqueue(files);
+  RunWorkersOn(&dw, SrcDirectory, options);
+}
+
+void FingerprintStore::RunWorkersOn(DirectoryWalker *dw,
+                                    const std::string root,
+                                    const WorkerOptions options) {
+  // Only take this process's share of the files, unless it is the
+  // fingerprints that are split
+  std::function<bool(const DirectoryEntry &)> filter;
+  if (ShardCount > 1 && !ShardFingerprints) {
+    filter = [this, root](const DirectoryEntry &entry) {
+      return Util::InShard(entry.Path, root, ShardIndex, ShardCount);
+    };
+  }
+  WorkScheduler *ws = new WorkScheduler(dw, filter);
+
+  // Pick up where a previous run left off, re-emitting what it found so the
+  // output of the resumed run is complete.
+  Journal *journal = nullptr;
+  if (options.JournalPath != "") {
+    journal = new Journal(options.JournalPath);
+    std::cout << journal->PreviousOutput() << std::flush;
+  }
+
   // Spawn threads for the actual fingerprint generation
   std::vector<std::thread> threads;
   for (int i = 0; i < options.NumThreads; i++) {
@@ -111,13 +274,14 @@ void FingerprintStore::RunWorkers(const WorkerOptions options) {
     // Use the power of filthy lambdas to start the things.
     switch (options.WType) {
     case GenerateWorker:
-      thread = std::thread([=] { Generate(dw, options.DstDirectory); });
+      thread = std::thread([=] { Generate(ws, journal, options.DstDirectory); });
       break;
     case MetadataWorker:
-      thread = std::thread([=] { ExtractMetadata(dw); });
+      thread = std::thread([=] { ExtractMetadata(ws, journal); });
       break;
     case FingerprintWorker:
-      thread = std::thread([=] { FindDuplicates(dw, options.FuzzFactor); });
+      thread = std::thread(
+          [=] { FindDuplicates(ws, journal, options.FuzzFactor); });
       break;
     }
 
@@ -130,16 +294,15 @@ void FingerprintStore::RunWorkers(const WorkerOptions options) {
       threads[i].join();
   }
 
-  // Wait also on the directory traversal thread to complete.
-  dw->Finish();
-  delete dw;
+  delete journal;
+  delete ws;
 }
 
-void FingerprintStore::FindDuplicates(DirectoryWalker *dw,
+void FingerprintStore::FindDuplicates(WorkScheduler *ws, Journal *journal,
                                       const int fuzzFactor) {
   while (true) {
-    auto next = dw->GetNext();
-    std::optional<boost::filesystem::path> entry = next.first;
+    auto next = ws->GetNext();
+    std::optional<DirectoryEntry> entry = next.first;
     bool completed = next.second;
 
     // No next value as the directory traversal has completed.
@@ -154,35 +317,42 @@ void FingerprintStore::FindDuplicates(DirectoryWalker *dw,
     }
 
     // Filter only known image suffixes
-    if (!Util::IsSupportedImage(entry.value()))
+    if (!Util::IsSupportedImage(entry->Path))
+      continue;
+
+    // Skip anything a previous run already finished
+    if (journal && journal->IsCompleted(entry->Path.string()))
       continue;
 
     // Read in one image, resize it to comparison specifications
-    auto filename = entry.value().string();
+    auto start = std::chrono::steady_clock::now();
+    auto filename = entry->Path.string();
     Magick::Image image;
     try {
       image.read(filename);
     } catch (const std::exception &e) {
-      // silently skip unreadable file for the moment
+      // silently skip unreadable file for the moment. It isn't journaled, so
+      // it is tried again on resume.
+      ws->Record(entry.value(), std::chrono::steady_clock::now() - start);
       continue;
     }
-    image.compressType(
-        MagickCore::CompressionType::NoCompression); // may not be needed
-    image.resize(FingerprintSpec);
+    PrepareForComparison(image);
 
     // Compare
-    FindMatchesForImage(image, filename, fuzzFactor);
+    std::string matches = FindMatchesForImage(image, filename, fuzzFactor);
+    std::cout << matches << std::flush;
+    if (journal)
+      journal->Complete(filename, matches);
+    ws->Record(entry.value(), std::chrono::steady_clock::now() - start);
   }
 }
 
-void FingerprintStore::Generate(DirectoryWalker *dw,
+void FingerprintStore::Generate(WorkScheduler *ws, Journal *journal,
                                 const std::string dstDirectory) {
-  boost::filesystem::path dest(dstDirectory);
-
   // Iterate through all files in the directory
   while (true) {
-    auto next = dw->GetNext();
-    std::optional<boost::filesystem::path> entry = next.first;
+    auto next = ws->GetNext();
+    std::optional<DirectoryEntry> entry = next.first;
     bool completed = next.second;
 
     // No next value as the directory traversal has completed.
@@ -197,49 +367,63 @@ void FingerprintStore::Generate(DirectoryWalker *dw,
     }
 
     // Filter only known image suffixes
-    if (!Util::IsSupportedImage(entry.value()))
+    if (!Util::IsSupportedImage(entry->Path))
       continue;
 
+    // Skip anything a previous run already finished
+    if (journal && journal->IsCompleted(entry->Path.string()))
+      continue;
+
+    // Progress goes to stderr, so that stdout only has results, e.g. the
+    // duplicates found while watching
     std::stringstream msg;
-    msg << entry.value().string() << std::endl;
-    std::cout << msg.str() << std::flush;
-    auto filename = entry.value().filename().replace_extension(
-        ".tif"); // save fingerprints uncompressed
+    msg << entry->Path.string() << std::endl;
+    std::cerr << msg.str() << std::flush;
+    auto start = std::chrono::steady_clock::now();
     Magick::Image image;
 
     try {
       // destination filename
-      auto outputFilename = boost::filesystem::path(dest);
-      outputFilename += filename;
+      auto outputFilename = FingerprintPathFor(entry->Path, dstDirectory);
 
-      image.read(entry.value().string());
+      image.read(entry->Path.string());
       image.defineValue("quantum", "format",
                         "floating-point"); // fix HDRI comparison issues
       image.depth(32);                     // also for the HDRI stuff
       image.compressType(
           MagickCore::CompressionType::NoCompression); // may not be needed
-      image.resize(FingerprintSpec);
-      image.attribute("comment", entry.value().string());
+      image.resize(Format.Geometry());
+      image.attribute("comment", entry->Path.string());
       image.write(outputFilename.string());
+
+      // The journal vouches for the fingerprint, so it has to reach the disk
+      // first
+      if (journal) {
+        if (!Util::SyncFile(outputFilename))
+          throw std::runtime_error("unable to sync " + outputFilename.string());
+        journal->Complete(entry->Path.string(), "");
+      }
     } catch (const std::exception &e) {
       // Some already seen:
       // Magick::ErrorCorruptImage
       // Magick::ErrorMissingDelegate
       // Magick::ErrorCoder
       // Magick::WarningImage
+      // Failures aren't journaled, so they are tried again on resume.
       std::stringstream msg;
-      msg << "skipping " << entry.value().string() << " " << e.what()
+      msg << "skipping " << entry->Path.string() << " " << e.what()
           << std::endl;
       std::cerr << msg.str() << std::flush;
     }
+    ws->Record(entry.value(), std::chrono::steady_clock::now() - start);
   }
 }
 
-void FingerprintStore::ExtractMetadata(DirectoryWalker *dw) {
+void FingerprintStore::ExtractMetadata(WorkScheduler *ws, Journal *journal) {
   // Iterate through all files in the directory
   while (true) {
-    auto next = dw->GetNext();
-    std::optional<boost::filesystem::path> entry = next.first;
+    auto next = ws->GetNext();
+    std::optional<DirectoryEntry> entry = next.first;
     bool completed = next.second;
 
     // No next value as the directory traversal has completed.
@@ -254,21 +438,28 @@ void FingerprintStore::ExtractMetadata(DirectoryWalker *dw) {
     }
 
     // Filter only known image suffixes
-    if (!Util::IsSupportedImage(entry.value()))
+    if (!Util::IsSupportedImage(entry->Path))
       continue;
 
+    // Skip anything a previous run already finished
+    if (journal && journal->IsCompleted(entry->Path.string()))
+      continue;
+
+    auto start = std::chrono::steady_clock::now();
     try {
       Magick::Image image;
-      std::string filename = entry.value().string();
+      std::string filename = entry->Path.string();
       image.read(filename);
       std::string createdAt = image.attribute("exif:DateTimeOriginal");
 
+      std::stringstream msg;
       if (createdAt != "") {
         std::string timestamp = ConvertExifTimestamp(createdAt);
-        std::stringstream msg;
         msg << filename << "\t" << timestamp << std::endl;
         std::cout << msg.str() << std::flush;
       }
+      if (journal)
+        journal->Complete(filename, msg.str());
     } catch (const std::exception &e) {
       // Some already seen:
       // Magick::ErrorCorruptImage
@@ -276,7 +467,89 @@ void FingerprintStore::ExtractMetadata(DirectoryWalker *dw) {
       // Magick::ErrorCoder
       // Magick::WarningImage
       // Don't bother printing anything as we might run into all kinds of files
-      // we can't read.
+      // we can't read. Failures aren't journaled, so they are tried again on
+      // resume.
+    }
+    ws->Record(entry.value(), std::chrono::steady_clock::now() - start);
+  }
+}
+
+boost::filesystem::path
+FingerprintStore::FingerprintPathFor(const boost::filesystem::path image,
+                                     const std::string dstDirectory) {
+  auto outputFilename = boost::filesystem::path(dstDirectory);
+  outputFilename += image.filename().replace_extension(
+      ".tif"); // save fingerprints uncompressed
+  return outputFilename;
+}
+
+void FingerprintStore::Watch(WorkerOptions options,
+                             const bool findDuplicates) {
+  // Start watching before the initial scan, so that nothing written during
+  // the scan is missed.
+  DirectoryWatcher watcher(SrcDirectory);
+  watcher.Exclude(options.DstDirectory);
+
+  // After lost events, only redo images that are newer than their
+  // fingerprints rather than the whole tree
+  std::string dstDirectory = options.DstDirectory;
+  watcher.SetRescanFilter([this, dstDirectory](
+                              const boost::filesystem::path &image) {
+    if (!Util::IsSupportedImage(image))
+      return false;
+
+    boost::system::error_code ec;
+    auto fingerprint = FingerprintPathFor(image, dstDirectory);
+    auto fingerprintTime = boost::filesystem::last_write_time(fingerprint, ec);
+    if (ec)
+      return true;
+    auto imageTime = boost::filesystem::last_write_time(image, ec);
+    return ec || imageTime >= fingerprintTime;
+  });
+  watcher.Watch();
+
+  options.WType = GenerateWorker;
+  RunWorkers(options);
+
+  // Changes are picked up by the watcher rather than the journal from here on
+  options.JournalPath = "";
+
+  if (findDuplicates) {
+    Load(options.DstDirectory);
+    SkipOwnFingerprints = true;
+  }
+
+  while (true) {
+    std::vector<boost::filesystem::path> changed =
+        watcher.WaitForChanges(std::chrono::milliseconds(2000));
+
+    std::vector<boost::filesystem::path> images;
+    for (auto &path : changed) {
+      if (Util::IsSupportedImage(path))
+        images.push_back(path);
+    }
+    if (images.empty())
+      continue;
+
+    std::cerr << images.size() << " new or changed files" << std::endl;
+
+    options.WType = GenerateWorker;
+    RunWorkers(options, images);
+
+    if (findDuplicates) {
+      // Add the whole batch before matching, so that copies arriving
+      // together are found as well.
+      for (auto &image : images) {
+        auto fingerprint = FingerprintPathFor(image, options.DstDirectory);
+        try {
+          AddFingerprint(fingerprint.string());
+        } catch (const std::exception &e) {
+          // Generation failed for this one, which has already been reported
+        }
+      }
+
+      options.WType = FingerprintWorker;
+      RunWorkers(options, images);
     }
   }
 }
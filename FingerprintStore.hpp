@@ -1,4 +1,13 @@
+#pragma once
+
+#include "FingerprintFormat.hpp"
+#include "Journal.hpp"
 #include "Magick++.h"
+#include "WorkScheduler.hpp"
+#include <optional>
+#include <shared_mutex>
+#include <sstream>
+#include <unordered_map>
 #include <vector>
 
 enum WorkerType { GenerateWorker, MetadataWorker, FingerprintWorker };
@@ -8,31 +17,113 @@ struct WorkerOptions {
   int FuzzFactor;
   std::string DstDirectory;
   WorkerType WType;
+  std::string JournalPath; // optional, enables resuming an interrupted run
+};
+
+// A fingerprint that an image was compared to, and how far apart they are
+// (root mean squared error, 0 for identical up to 1).
+struct Match {
+  std::string Fingerprint;
+  double Distance;
 };
 
 class FingerprintStore {
 public:
   FingerprintStore(std::string srcDirectory);
 
+  // Load fingerprints, in the format recorded in the fingerprint directory.
   void Load();
 
-  // Run a given task in multiple threads.
+  // Load fingerprints from a directory other than the source directory.
+  void Load(const std::string directory);
+
+  // Set the format for generating fingerprints. Loading fingerprints uses
+  // the format recorded with them instead.
+  void SetFormat(const FingerprintFormat format);
+
+  // Only handle this process's share of the work, when it is split across
+  // count processes. Either the files being processed (queries, or images to
+  // generate fingerprints for) or the fingerprints loaded are split.
+  void SetShard(const int index, const int count, const bool fingerprints);
+
+  // Read a single fingerprint file and add it to the loaded set.
+  // Safe to call while matching is in progress on other threads.
+  void AddFingerprint(const std::string filename);
+
+  // Run a given task in multiple threads. Generating throws if the
+  // destination already holds fingerprints in a different format.
   void RunWorkers(const WorkerOptions options);
 
+  // Run a given task in multiple threads over a list of files rather than a
+  // directory.
+  void RunWorkers(const WorkerOptions options,
+                  const std::vector<boost::filesystem::path> &files);
+
+  // Generate fingerprints for the source directory, then keep watching it and
+  // fingerprint new or changed files as they arrive. If findDuplicates is
+  // set, new files are also matched against the existing fingerprints
+  // and each other. Never returns.
+  void Watch(WorkerOptions options, const bool findDuplicates);
+
+  // Bring a freshly read image into the same shape as the fingerprints so
+  // they can be compared.
+  void PrepareForComparison(Magick::Image &image) const;
+
+  // Compare a single image to all of the fingerprints.
+  // Returns the output lines for any matches found.
+  std::string FindMatchesForImage(Magick::Image image,
+                                  const std::string filename,
+                                  const int fuzzFactor);
+
+  // Compare several prepared images to all of the fingerprints in a single
+  // pass, so each fingerprint is only fetched once per batch. Returns the
+  // fingerprints within maxDistance of each image, in the same order as the
+  // images.
+  std::vector<std::vector<Match>>
+  FindMatchesForImages(std::vector<std::pair<Magick::Image, std::string>> images,
+                       const int fuzzFactor, const double maxDistance);
+
+  // Distance below which images are reported as duplicates
+  double MatchThreshold() const { return HighDistortionThreshold; }
+
+  // How a match at the given distance is described in the output, e.g.
+  // "is identical to".
+  std::string Describe(const double distance) const;
+
 private:
-  // Compare a single image to all of the fingerprints
-  void FindMatchesForImage(Magick::Image image, const std::string filename,
-                           const int fuzzFactor);
+  // Runs the workers over whatever the walker hands out. root is the top of
+  // the tree the files come from, for sharding.
+  void RunWorkersOn(DirectoryWalker *dw, const std::string root,
+                    const WorkerOptions options);
+
+  // Where the fingerprint for an image is written
+  boost::filesystem::path FingerprintPathFor(const boost::filesystem::path image,
+                                             const std::string dstDirectory);
+
+  // Pixels of a prepared image, in the layout of the fingerprints
+  std::vector<uint8_t> ExtractPixels(Magick::Image &image) const;
+
+  // Distance between an image (and its extracted pixels) and one
+  // fingerprint, from 0 (identical) to 1.
+  double CompareToFingerprint(Magick::Image &image, const uint8_t *pixels,
+                              const size_t index, const int fuzzFactor);
+
+  // Index of the fingerprint generated from the given image, if
+  // SkipOwnFingerprints is set and there is one. Called with
+  // FingerprintsMutex held.
+  std::optional<size_t> OwnFingerprint(const std::string &filename);
 
   // Find duplicates in a whole directory compared to the fingerprints.
-  void FindDuplicates(DirectoryWalker *dw, const int fuzzFactor);
+  void FindDuplicates(WorkScheduler *ws, Journal *journal,
+                      const int fuzzFactor);
 
   // Entrypoint for generating fingerprints in parallel threads
-  void Generate(DirectoryWalker *dw, const std::string dstDirectory);
+  void Generate(WorkScheduler *ws, Journal *journal,
+                const std::string dstDirectory);
 
   // Worker for outputting metadata.
   // Currently the only metadata is the created date of the image.
-  void ExtractMetadata(DirectoryWalker *dw);
+  void ExtractMetadata(WorkScheduler *ws, Journal *journal);
 
   // Converts a timestamp like "2011:07:09 20:01:28" into a standard format
   // (hyphens between date parts).
@@ -41,13 +132,35 @@ private:
   // Source directory for the given operation
   std::string SrcDirectory;
 
-  // Store all fingerprint images in memory for now
+  // Store all fingerprint images in memory for now, along with the name to
+  // report for matches
   std::vector<std::pair<Magick::Image, std::string>> Fingerprints;
 
+  // Pixels of all fingerprints, back to back in the layout of the format,
+  // for the comparison kernels
+  std::vector<uint8_t> FingerprintPixels;
+
+  // Fingerprint name to position in Fingerprints, for replacing fingerprints
+  // that are added again
+  std::unordered_map<std::string, size_t> FingerprintIndex;
+
+  // Guards Fingerprints against additions while matching is in progress
+  std::shared_mutex FingerprintsMutex;
+
   const double LowDistortionThreshold = 0.01;  // identical images
   const double HighDistortionThreshold = 0.02; // similar images
 
-  // Dimension specification for comparison fingerprints.
-  // ! means ignoring proportions
-  const std::string FingerprintSpec = "100x100!";
+  // Which share of the work this process handles (see SetShard)
+  int ShardIndex = 0;
+  int ShardCount = 1;
+  bool ShardFingerprints = false;
+
+  // Set when watching, where new files are matched after their own
+  // fingerprints have been added.
+  bool SkipOwnFingerprints = false;
+
+  // Geometry and channel layout of the fingerprints, and the matching
+  // comparison kernel
+  FingerprintFormat Format;
+  FingerprintComparator Comparator = FingerprintComparator::For(Format);
 };
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "Journal.hpp"
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+// The file starts with the Magic line. Each record after it is:
+//   <key length> TAB <output length> NEWLINE <key bytes> <output bytes>
+// The header only ever contains digits, so keys and output may contain
+// anything (including newlines), and a partially written record can be
+// detected.
+
+Journal::Journal(const std::string path) : Path(path) {
+  Replay();
+
+  Fd = open(Path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (Fd < 0)
+    throw std::runtime_error("unable to open journal " + Path);
+
+  // Mark a new journal as one, so that it can be told apart from other files
+  if (lseek(Fd, 0, SEEK_END) == 0) {
+    std::string magic = std::string(Magic) + "\n";
+    if (write(Fd, magic.data(), magic.size()) != (ssize_t)magic.size() ||
+        fsync(Fd) != 0) {
+      close(Fd);
+      Fd = -1;
+      throw std::runtime_error("unable to write journal " + Path);
+    }
+  }
+}
+
+Journal::~Journal() {
+  Flush();
+  if (Fd >= 0)
+    close(Fd);
+}
+
+void Journal::Replay() {
+  std::ifstream in(Path, std::ios::binary);
+  if (!in)
+    return;
+
+  // An empty file, or one with only part of the magic line, was never
+  // written to after being created. Anything else must be a journal.
+  std::string magic;
+  if (!std::getline(in, magic))
+    return;
+  if (in.eof() && std::string(Magic).compare(0, magic.size(), magic) == 0) {
+    in.close();
+    if (truncate(Path.c_str(), 0) != 0)
+      throw std::runtime_error("unable to truncate journal " + Path);
+    return;
+  }
+  if (in.eof() || magic != Magic)
+    throw std::runtime_error(Path + " is not a journal, not using it");
+
+  std::streamoff good = in.tellg();
+  std::string header;
+  while (std::getline(in, header)) {
+    // getline() also succeeds on a final line without a newline
+    if (in.eof())
+      break;
+
+    auto tab = header.find('\t');
+    if (tab == std::string::npos)
+      break;
+
+    size_t keyLength, outputLength;
+    try {
+      keyLength = std::stoul(header.substr(0, tab));
+      outputLength = std::stoul(header.substr(tab + 1));
+    } catch (const std::exception &e) {
+      break;
+    }
+
+    std::string key(keyLength, '\0');
+    std::string output(outputLength, '\0');
+    if (!in.read(key.data(), keyLength) || !in.read(output.data(), outputLength))
+      break;
+
+    Completed.insert(key);
+    Previous += output;
+    good = in.tellg();
+  }
+  in.close();
+
+  // Drop any torn record so that new records are appended after the last
+  // complete one.
+  if (truncate(Path.c_str(), good) != 0)
+    throw std::runtime_error("unable to truncate journal " + Path);
+
+  if (!Completed.empty())
+    std::cerr << "Resuming: " << Completed.size()
+              << " entries already completed according to " << Path
+              << std::endl;
+}
+
+bool Journal::IsCompleted(const std::string &key) const {
+  return Completed.count(key) > 0;
+}
+
+void Journal::Complete(const std::string &key, const std::string &output) {
+  std::stringstream record;
+  record << key.size() << '\t' << output.size() << '\n' << key << output;
+
+  std::string batch;
+  {
+    std::lock_guard<std::mutex> lock(BufferMutex);
+    Buffer += record.str();
+    if (++Buffered < BatchSize)
+      return;
+
+    batch.swap(Buffer);
+    Buffered = 0;
+  }
+
+  Write(batch);
+}
+
+void Journal::Flush() {
+  std::string batch;
+  {
+    std::lock_guard<std::mutex> lock(BufferMutex);
+    batch.swap(Buffer);
+    Buffered = 0;
+  }
+
+  if (!batch.empty())
+    Write(batch);
+}
+
+void Journal::Write(const std::string &records) {
+  std::lock_guard<std::mutex> lock(WriteMutex);
+  if (Fd < 0)
+    return;
+
+  // Remember where the batch starts, so that a failed write can be undone
+  // rather than leaving a torn record for later batches to be appended after.
+  off_t start = lseek(Fd, 0, SEEK_END);
+
+  const char *data = records.data();
+  size_t remaining = records.size();
+  bool failed = start < 0;
+  while (!failed && remaining > 0) {
+    ssize_t written = write(Fd, data, remaining);
+    if (written < 0) {
+      failed = true;
+      break;
+    }
+    data += written;
+    remaining -= written;
+  }
+
+  if (!failed && fsync(Fd) != 0)
+    failed = true;
+
+  if (!failed)
+    return;
+
+  if (start >= 0 && ftruncate(Fd, start) == 0) {
+    std::cerr << "unable to write to journal " << Path
+              << ", these entries will be redone on resume" << std::endl;
+    return;
+  }
+
+  // We can't tell what state the file is in, so stop adding to it
+  std::cerr << "unable to write to journal " << Path
+            << ", journaling disabled" << std::endl;
+  close(Fd);
+  Fd = -1;
+}
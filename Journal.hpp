@@ -0,0 +1,59 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// Append-only record of completed work, so that a long run which is killed
+// part way through can be restarted without repeating everything.
+//
+// Each record is a key (the path that was processed) and whatever output was
+// emitted for it. Records are buffered and written + fsynced in batches, so a
+// crash loses at most the last batch, which is then simply redone.
+class Journal {
+public:
+  // Opens the journal, creating it if necessary, and reads back any records
+  // written by a previous run. A partially written trailing record is
+  // discarded. Throws rather than touching an existing file which isn't a
+  // journal.
+  Journal(const std::string path);
+  ~Journal();
+
+  // Whether the key was completed by a previous run.
+  bool IsCompleted(const std::string &key) const;
+
+  // Output recorded by previous runs, in the order it was written.
+  const std::string &PreviousOutput() const { return Previous; }
+
+  // Record that the key has been processed, along with its output.
+  // Safe to call from multiple threads.
+  void Complete(const std::string &key, const std::string &output);
+
+  // Write and fsync any buffered records.
+  void Flush();
+
+private:
+  // Read existing records and truncate any torn write at the end.
+  void Replay();
+
+  // Write the given records to the file and fsync it.
+  void Write(const std::string &records);
+
+  std::string Path;
+  int Fd = -1;
+
+  std::unordered_set<std::string> Completed;
+  std::string Previous;
+
+  // Records waiting to be written. Buffering is under its own lock so that
+  // threads aren't held up while another is waiting on fsync.
+  std::string Buffer;
+  int Buffered = 0;
+  std::mutex BufferMutex;
+  std::mutex WriteMutex;
+
+  const int BatchSize = 64;
+
+  // First line of every journal
+  static constexpr const char *Magic = "photo-fingerprint journal 1";
+};
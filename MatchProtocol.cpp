@@ -0,0 +1,107 @@
+#include "MatchProtocol.hpp"
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace MatchProtocol {
+
+// Fill in a socket address, failing if the path is too long to fit
+static bool makeAddress(const std::string path, sockaddr_un &address) {
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  return true;
+}
+
+int Listen(const std::string path) {
+  sockaddr_un address;
+  if (!makeAddress(path, address))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  unlink(path.c_str());
+  if (bind(fd, (sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int Connect(const std::string path) {
+  sockaddr_un address;
+  if (!makeAddress(path, address))
+    return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  if (connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Append whatever is available on the socket to the buffer
+static bool fill(int fd, std::string &buffer) {
+  char chunk[65536];
+  ssize_t received = read(fd, chunk, sizeof(chunk));
+  if (received <= 0)
+    return false;
+
+  buffer.append(chunk, received);
+  return true;
+}
+
+bool ReadLine(int fd, std::string &buffer, std::string &line) {
+  size_t newline;
+  while ((newline = buffer.find('\n')) == std::string::npos) {
+    // Don't let a peer that never sends a newline use up all our memory
+    if (buffer.size() > MaxLineLength)
+      return false;
+    if (!fill(fd, buffer))
+      return false;
+  }
+  if (newline > MaxLineLength)
+    return false;
+
+  line = buffer.substr(0, newline);
+  buffer.erase(0, newline + 1);
+  return true;
+}
+
+bool ReadBytes(int fd, std::string &buffer, size_t length, std::string &data) {
+  while (buffer.size() < length) {
+    if (!fill(fd, buffer))
+      return false;
+  }
+
+  data = buffer.substr(0, length);
+  buffer.erase(0, length);
+  return true;
+}
+
+bool WriteAll(int fd, const std::string &data) {
+  const char *remaining = data.data();
+  size_t length = data.size();
+  while (length > 0) {
+    ssize_t written = send(fd, remaining, length, MSG_NOSIGNAL);
+    if (written < 0)
+      return false;
+
+    remaining += written;
+    length -= written;
+  }
+  return true;
+}
+
+} // namespace MatchProtocol
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+
+// Helpers for the line-based protocol spoken over the match server's Unix
+// domain socket. Requests are:
+//
+//   MATCH <path>\n            match an image file readable by the server
+//   DATA <length>\n<bytes>    match the image contained in the given bytes
+//   ADD <path>\n              add a fingerprint file to the loaded store
+//   THRESHOLD <distance>\n    report matches below this distance for the
+//                             rest of the connection (default 0.02)
+//
+// Each request is answered with zero or more result lines followed by
+// "END\n", or a single "ERROR <message>\n" line. A request line longer than
+// MaxLineLength closes the connection. Each result line of a match
+// request is
+//
+//   <image> TAB <description> TAB <fingerprint> TAB <distance>
+//
+// where distance is the root mean squared error between the image and the
+// fingerprint, from 0 (identical) to 1, and description is "is identical to",
+// "is similar to", or "resembles" (above the usual duplicate threshold), so
+// that clients can apply their own thresholds.
+namespace MatchProtocol {
+
+// Create a listening socket at the given path, replacing any stale socket.
+// Returns the file descriptor, or -1 on failure.
+int Listen(const std::string path);
+
+// Connect to the server socket. Returns the file descriptor, or -1 on
+// failure.
+int Connect(const std::string path);
+
+// Longest line accepted by ReadLine, newline excluded. Far longer than any
+// request or result line needs to be.
+const size_t MaxLineLength = 64 * 1024;
+
+// Read up to the next newline (which is not included in line). Any extra data
+// received is kept in buffer for subsequent reads. Returns false on EOF,
+// error, or a line longer than MaxLineLength.
+bool ReadLine(int fd, std::string &buffer, std::string &line);
+
+// Read exactly length bytes, using buffer as above.
+bool ReadBytes(int fd, std::string &buffer, size_t length, std::string &data);
+
+// Write all of data, retrying on short writes.
+bool WriteAll(int fd, const std::string &data);
+
+} // namespace MatchProtocol
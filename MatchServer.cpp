@@ -0,0 +1,203 @@
+#include "MatchServer.hpp"
+#include "MatchProtocol.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+MatchServer::MatchServer(FingerprintStore *store, const std::string socketPath,
+                         const int numThreads, const int fuzzFactor,
+                         const size_t maxBatchSize)
+    : Store(store), SocketPath(socketPath), NumThreads(numThreads),
+      FuzzFactor(fuzzFactor), MaxBatchSize(maxBatchSize) {}
+
+void MatchServer::Run() {
+  int listenFd = MatchProtocol::Listen(SocketPath);
+  if (listenFd < 0) {
+    std::cerr << "unable to listen on " << SocketPath << std::endl;
+    return;
+  }
+
+  for (int i = 0; i < NumThreads; i++)
+    std::thread([this] { Worker(); }).detach();
+
+  std::cerr << "Listening on " << SocketPath << std::endl;
+  while (true) {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+
+    std::thread([this, fd] { HandleConnection(fd); }).detach();
+  }
+}
+
+void MatchServer::HandleConnection(int fd) {
+  std::string buffer;
+  double maxDistance = Store->MatchThreshold();
+
+  while (true) {
+    std::string error;
+    bool applied = false;
+    Request *request = ReadRequest(fd, buffer, maxDistance, applied, error);
+    if (request == nullptr) {
+      if (applied) {
+        if (!MatchProtocol::WriteAll(fd, "END\n"))
+          break;
+        continue;
+      }
+      if (error == "")
+        break; // client went away
+
+      if (!MatchProtocol::WriteAll(fd, "ERROR " + error + "\n"))
+        break;
+      continue;
+    }
+
+    // Hand the request to the workers and wait for the answer
+    std::future<std::string> response = request->Response.get_future();
+    {
+      std::lock_guard<std::mutex> lock(PendingMutex);
+      Pending.push_back(request);
+    }
+    PendingCondition.notify_one();
+
+    std::string result = response.get();
+    delete request;
+
+    if (!MatchProtocol::WriteAll(fd, result))
+      break;
+  }
+
+  close(fd);
+}
+
+MatchServer::Request *MatchServer::ReadRequest(int fd, std::string &buffer,
+                                               double &maxDistance,
+                                               bool &applied,
+                                               std::string &error) {
+  std::string line;
+  if (!MatchProtocol::ReadLine(fd, buffer, line))
+    return nullptr;
+
+  auto space = line.find(' ');
+  std::string command = line.substr(0, space);
+  std::string argument = space == std::string::npos ? "" : line.substr(space + 1);
+
+  if (command == "MATCH" && argument != "")
+    return new Request{MatchPath, argument, maxDistance};
+
+  if (command == "ADD" && argument != "")
+    return new Request{AddFingerprint, argument, maxDistance};
+
+  if (command == "THRESHOLD") {
+    try {
+      maxDistance = std::stod(argument);
+      applied = true;
+    } catch (const std::exception &e) {
+      error = "invalid distance";
+    }
+    return nullptr;
+  }
+
+  if (command == "DATA") {
+    size_t length;
+    try {
+      length = std::stoul(argument);
+    } catch (const std::exception &e) {
+      error = "invalid length";
+      return nullptr;
+    }
+    if (length == 0 || length > MaxDataSize) {
+      // We can't skip the payload reliably, so give up on the connection
+      MatchProtocol::WriteAll(fd, "ERROR invalid length\n");
+      return nullptr;
+    }
+
+    std::string data;
+    if (!MatchProtocol::ReadBytes(fd, buffer, length, data))
+      return nullptr;
+    return new Request{MatchData, data, maxDistance};
+  }
+
+  error = "unknown request";
+  return nullptr;
+}
+
+void MatchServer::Worker() {
+  while (true) {
+    // Take a share of what has queued up and answer it together. When there
+    // are no more requests than workers, each request is handled on its own.
+    std::vector<Request *> batch;
+    {
+      std::unique_lock<std::mutex> lock(PendingMutex);
+      PendingCondition.wait(lock, [this] { return !Pending.empty(); });
+      size_t share = (Pending.size() + NumThreads - 1) / NumThreads;
+      size_t limit = std::min(share, MaxBatchSize);
+      while (!Pending.empty() && batch.size() < limit) {
+        batch.push_back(Pending.front());
+        Pending.pop_front();
+      }
+    }
+
+    ProcessBatch(batch);
+  }
+}
+
+void MatchServer::ProcessBatch(std::vector<Request *> &batch) {
+  std::vector<std::pair<Magick::Image, std::string>> images;
+  std::vector<Request *> matchRequests;
+  double maxDistance = 0;
+
+  for (auto request : batch) {
+    try {
+      if (request->Type == AddFingerprint) {
+        Store->AddFingerprint(request->Argument);
+        request->Response.set_value("END\n");
+        continue;
+      }
+
+      Magick::Image image;
+      std::string name;
+      if (request->Type == MatchPath) {
+        image.read(request->Argument);
+        name = request->Argument;
+      } else {
+        image.read(Magick::Blob(request->Argument.data(),
+                                request->Argument.size()));
+        name = "-";
+      }
+      Store->PrepareForComparison(image);
+      images.push_back(std::pair(image, name));
+      matchRequests.push_back(request);
+      maxDistance = std::max(maxDistance, request->MaxDistance);
+    } catch (const std::exception &e) {
+      std::stringstream msg;
+      msg << "ERROR " << e.what() << std::endl;
+      request->Response.set_value(msg.str());
+    }
+  }
+
+  if (images.empty())
+    return;
+
+  // Compare using the loosest threshold in the batch, then narrow the
+  // results down for each request.
+  std::vector<std::vector<Match>> results =
+      Store->FindMatchesForImages(images, FuzzFactor, maxDistance);
+  for (size_t i = 0; i < matchRequests.size(); i++) {
+    std::stringstream response;
+    response << std::setprecision(6);
+    for (auto &match : results[i]) {
+      if (match.Distance >= matchRequests[i]->MaxDistance)
+        continue;
+      response << images[i].second << "\t" << Store->Describe(match.Distance)
+               << "\t" << match.Fingerprint << "\t" << match.Distance
+               << std::endl;
+    }
+    response << "END" << std::endl;
+    matchRequests[i]->Response.set_value(response.str());
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+
+#include "FingerprintStore.hpp"
+
+// Keeps a loaded FingerprintStore in memory and answers match requests over a
+// Unix domain socket (see MatchProtocol.hpp for the protocol), so that new
+// images can be checked without paying the cost of loading the store each
+// time.
+class MatchServer {
+public:
+  // maxBatchSize of 1 turns batching off, e.g. to compare latency with the
+  // load test in photo-fingerprint-client.
+  MatchServer(FingerprintStore *store, const std::string socketPath,
+              const int numThreads, const int fuzzFactor,
+              const size_t maxBatchSize);
+
+  // Listen for and serve connections. Only returns if the socket can't be
+  // created.
+  void Run();
+
+private:
+  enum RequestType { MatchPath, MatchData, AddFingerprint };
+
+  struct Request {
+    RequestType Type;
+    std::string Argument; // path, or image bytes for MatchData
+    double MaxDistance;   // for match requests
+    std::promise<std::string> Response;
+  };
+
+  // Read requests from one client until it disconnects
+  void HandleConnection(int fd);
+
+  // Parse a request line (plus payload, if any) from the client. Settings
+  // for the connection are applied directly, setting applied rather than
+  // returning a request.
+  Request *ReadRequest(int fd, std::string &buffer, double &maxDistance,
+                       bool &applied, std::string &error);
+
+  // Takes batches of queued requests and answers them
+  void Worker();
+
+  // Answer a batch of requests. Match requests are compared to the store in
+  // one pass, which saves memory bandwidth on stores too large for the cache.
+  void ProcessBatch(std::vector<Request *> &batch);
+
+  FingerprintStore *Store;
+  std::string SocketPath;
+  int NumThreads;
+  int FuzzFactor;
+
+  std::deque<Request *> Pending;
+  std::mutex PendingMutex;
+  std::condition_variable PendingCondition;
+
+  // Upper limit on a batch (1 by default, i.e. no batching). Batches are also
+  // limited to an even share of what is pending, so that requests are spread
+  // across all the workers rather than queued up behind one of them.
+  size_t MaxBatchSize;
+  const size_t MaxDataSize = 256 * 1024 * 1024;
+};
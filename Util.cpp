@@ -1,4 +1,6 @@
 #include "Util.hpp"
+#include <fcntl.h>
+#include <unistd.h>
 
 bool Util::IsSupportedImage(const boost::filesystem::path filename) {
   auto ext = filename.extension().string();
@@ -10,4 +12,37 @@ bool Util::IsSupportedImage(const boost::filesystem::path filename) {
     return true;
   }
   return false;
-}
\ No newline at end of file
+}
+
+bool Util::InShard(const boost::filesystem::path filename,
+                   const boost::filesystem::path root, const int index,
+                   const int count) {
+  if (count <= 1)
+    return true;
+
+  // Strip the root (ignoring any trailing slashes on it)
+  std::string prefix = root.generic_string();
+  while (prefix.size() > 1 && prefix.back() == '/')
+    prefix.pop_back();
+  std::string relative = filename.generic_string();
+  if (relative.compare(0, prefix.size(), prefix) == 0)
+    relative.erase(0, prefix.size());
+
+  // FNV-1a, as std::hash isn't guaranteed to be the same between builds
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : relative) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash % count == (uint64_t)index;
+}
+
+bool Util::SyncFile(const boost::filesystem::path filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+}
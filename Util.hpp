@@ -1,7 +1,19 @@
+#pragma once
+
 #include <boost/filesystem.hpp>
 
 // FIXME: Find a better place for this
 class Util {
 public:
   static bool IsSupportedImage(const boost::filesystem::path filename);
+
+  // Whether a file belongs to the given shard when work is split into count
+  // shards. The path is hashed relative to root, so every machine assigns
+  // files the same way however the tree is mounted.
+  static bool InShard(const boost::filesystem::path filename,
+                      const boost::filesystem::path root, const int index,
+                      const int count);
+
+  // Flush a file's contents to disk. Returns false if that fails.
+  static bool SyncFile(const boost::filesystem::path filename);
 };
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "WorkScheduler.hpp"
+#include <algorithm>
+#include <cctype>
+
+WorkScheduler::WorkScheduler(
+    DirectoryWalker *dw, std::function<bool(const DirectoryEntry &)> filter)
+    : Walker(dw), Filter(filter) {}
+
+std::pair<std::optional<DirectoryEntry>, bool> WorkScheduler::GetNext() {
+  std::lock_guard<std::mutex> lock(Mutex);
+  bool completed = Drain();
+
+  // Pick the format whose largest pending entry has the highest estimated
+  // cost. There are only ever a handful of formats so a scan is fine.
+  Format *best = nullptr;
+  double bestCost = -1;
+  for (auto &[name, format] : Formats) {
+    if (format.Pending.empty())
+      continue;
+
+    double cost = format.Pending.top().Size * CostPerByte(format);
+    if (cost > bestCost) {
+      best = &format;
+      bestCost = cost;
+    }
+  }
+
+  if (best == nullptr)
+    return {std::nullopt, completed};
+
+  DirectoryEntry entry = best->Pending.top();
+  best->Pending.pop();
+  return {entry, false};
+}
+
+void WorkScheduler::Record(const DirectoryEntry &entry,
+                           const std::chrono::steady_clock::duration elapsed) {
+  // Entries with unknown size don't tell us anything about cost per byte
+  if (entry.Size == 0)
+    return;
+
+  double seconds = std::chrono::duration<double>(elapsed).count();
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  Format &format = Formats[FormatOf(entry.Path)];
+  format.Bytes += entry.Size;
+  format.Seconds += seconds;
+  TotalBytes += entry.Size;
+  TotalSeconds += seconds;
+}
+
+bool WorkScheduler::Drain() {
+  while (true) {
+    auto next = Walker->GetNext();
+    if (!next.first.has_value())
+      return next.second;
+
+    if (Filter && !Filter(next.first.value()))
+      continue;
+
+    Formats[FormatOf(next.first->Path)].Pending.push(next.first.value());
+  }
+}
+
+double WorkScheduler::CostPerByte(const Format &format) const {
+  if (format.Bytes > 0 && format.Seconds > 0)
+    return format.Seconds / format.Bytes;
+
+  if (TotalBytes > 0 && TotalSeconds > 0)
+    return TotalSeconds / TotalBytes;
+
+  return 1.0;
+}
+
+std::string WorkScheduler::FormatOf(const boost::filesystem::path &path) {
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return ext;
+}
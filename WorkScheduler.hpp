@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "DirectoryWalker.hpp"
+
+// Hands out entries from a DirectoryWalker in order of estimated processing
+// cost, most expensive first, so that a run doesn't finish with one thread
+// working through a cluster of huge files while the others sit idle.
+//
+// The cost of an entry is its size multiplied by a per-format cost per byte,
+// which is learned from the timings that workers report via Record().
+class WorkScheduler {
+public:
+  // Entries for which the optional filter returns false are dropped.
+  WorkScheduler(DirectoryWalker *dw,
+                std::function<bool(const DirectoryEntry &)> filter = nullptr);
+
+  // Same contract as DirectoryWalker::GetNext(), but returns the most
+  // expensive entry seen so far rather than the next one in directory order.
+  std::pair<std::optional<DirectoryEntry>, bool> GetNext();
+
+  // Report how long an entry took to process, to refine the estimates for
+  // its format.
+  void Record(const DirectoryEntry &entry,
+              const std::chrono::steady_clock::duration elapsed);
+
+private:
+  struct BySize {
+    bool operator()(const DirectoryEntry &a, const DirectoryEntry &b) const {
+      return a.Size < b.Size;
+    }
+  };
+
+  // Within a format cost grows with size, so each format keeps its pending
+  // entries in a max-heap by size and only the heads need to be compared.
+  struct Format {
+    std::priority_queue<DirectoryEntry, std::vector<DirectoryEntry>, BySize>
+        Pending;
+    double Bytes = 0;
+    double Seconds = 0;
+  };
+
+  // Move everything the walker has found so far into the per-format heaps.
+  // Returns whether traversal has completed.
+  bool Drain();
+
+  // Estimated seconds per byte for the format, falling back to the average
+  // across all formats (or 1.0) until there are measurements for it.
+  double CostPerByte(const Format &format) const;
+
+  static std::string FormatOf(const boost::filesystem::path &path);
+
+  DirectoryWalker *Walker;
+  std::function<bool(const DirectoryEntry &)> Filter;
+  std::map<std::string, Format> Formats;
+  double TotalBytes = 0;
+  double TotalSeconds = 0;
+  std::mutex Mutex;
+};
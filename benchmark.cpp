@@ -0,0 +1,141 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "FingerprintFormat.hpp"
+#include "Magick++.h"
+#include "Util.hpp"
+
+// Compares the fingerprint formats for accuracy and comparison throughput.
+//
+// Each image in the directory is paired with a degraded copy of itself
+// (downscaled and re-encoded as a low quality JPEG), which should be found as
+// a duplicate, while every other image should not be.
+
+void usage() {
+  std::cerr << "photo-fingerprint-benchmark:" << std::endl << std::endl;
+  std::cerr << " -s <image directory> [-n <max images>]" << std::endl;
+  exit(1);
+}
+
+const double HighDistortionThreshold = 0.02; // as in FingerprintStore
+
+// Pixels for each image in the given format
+std::vector<uint8_t> extractAll(std::vector<Magick::Image> images,
+                                const FingerprintFormat format,
+                                const FingerprintComparator comparator) {
+  std::vector<uint8_t> pixels(images.size() * comparator.Length);
+  for (size_t i = 0; i < images.size(); i++) {
+    images[i].resize(format.Geometry());
+    comparator.Extract(images[i], &pixels[i * comparator.Length]);
+  }
+  return pixels;
+}
+
+int main(int argc, char **argv) {
+  int ch = 0;
+  std::string srcDirectory;
+  size_t maxImages = 200;
+
+  while ((ch = getopt(argc, argv, "s:n:")) != -1) {
+    switch (ch) {
+    case 's':
+      srcDirectory = optarg;
+      break;
+    case 'n':
+      maxImages = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (srcDirectory == "")
+    usage();
+
+  // Read the originals and make the degraded copies
+  std::vector<Magick::Image> originals, copies;
+  for (auto &entry :
+       boost::filesystem::recursive_directory_iterator(srcDirectory)) {
+    if (originals.size() >= maxImages)
+      break;
+    if (!Util::IsSupportedImage(entry.path()))
+      continue;
+
+    try {
+      Magick::Image image(entry.path().string());
+      image.resize(Magick::Geometry("400x400"));
+
+      Magick::Image copy = image;
+      copy.resize(Magick::Geometry("200x200"));
+      copy.magick("JPEG");
+      copy.quality(60);
+      Magick::Blob blob;
+      copy.write(&blob);
+      copy.read(blob);
+
+      originals.push_back(image);
+      copies.push_back(copy);
+    } catch (const std::exception &e) {
+      continue;
+    }
+  }
+
+  size_t n = originals.size();
+  if (n < 2) {
+    std::cerr << "need at least two readable images" << std::endl;
+    return 1;
+  }
+  std::cout << n << " images, " << n * n << " comparisons per format"
+            << std::endl
+            << std::endl;
+
+  std::cout << std::left << std::setw(14) << "format" << std::setw(10)
+            << "bytes" << std::setw(10) << "recall" << std::setw(16)
+            << "false pos rate" << "comparisons/s" << std::endl;
+
+  for (int size : FingerprintFormat::SupportedSizes) {
+    for (std::string layout : {"rgb", "gray", "yuv420"}) {
+      auto format =
+          FingerprintFormat::Parse(std::to_string(size), layout).value();
+      auto comparator = FingerprintComparator::For(format);
+      auto fingerprints = extractAll(originals, format, comparator);
+      auto queries = extractAll(copies, format, comparator);
+
+      size_t found = 0, falsePositives = 0;
+      double checksum = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (size_t q = 0; q < n; q++) {
+        for (size_t f = 0; f < n; f++) {
+          double distance =
+              comparator.Distance(&queries[q * comparator.Length],
+                                  &fingerprints[f * comparator.Length]);
+          checksum += distance;
+          if (distance < HighDistortionThreshold) {
+            if (q == f)
+              found++;
+            else
+              falsePositives++;
+          }
+        }
+      }
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+
+      std::cout << std::setw(14) << format.ToString() << std::setw(10)
+                << comparator.Length << std::setw(10)
+                << double(found) / n << std::setw(16)
+                << double(falsePositives) / (n * (n - 1))
+                << (n * n) / seconds << std::endl;
+
+      // Keep the compiler from discarding the comparisons
+      if (checksum < 0)
+        return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "MatchProtocol.hpp"
+
+void usage() {
+  std::cerr << "photo-fingerprint-client:" << std::endl << std::endl;
+  std::cerr << " Find matches for images:" << std::endl;
+  std::cerr << " -S <server socket> [-b] [-d <max distance>] <image>..."
+            << std::endl;
+  std::cerr << "   -b sends the image contents rather than the path"
+            << std::endl;
+  std::cerr << "   -d reports matches up to this distance (default 0.02)"
+            << std::endl;
+  std::cerr << std::endl;
+  std::cerr << " Add fingerprints to the server:" << std::endl;
+  std::cerr << " -S <server socket> -a <fingerprint>..." << std::endl;
+  std::cerr << std::endl;
+  std::cerr << " Load test:" << std::endl;
+  std::cerr << " -S <server socket> [-b] -n <requests> -c <concurrency> "
+               "<image>..."
+            << std::endl;
+  exit(1);
+}
+
+// Build the request for a single file
+std::string makeRequest(const std::string filename, const bool add,
+                        const bool sendData) {
+  if (add)
+    return "ADD " + boost::filesystem::absolute(filename).string() + "\n";
+
+  if (!sendData)
+    return "MATCH " + boost::filesystem::absolute(filename).string() + "\n";
+
+  std::ifstream in(filename, std::ios::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return "DATA " + std::to_string(contents.str().size()) + "\n" +
+         contents.str();
+}
+
+// Send one request and collect the response lines, excluding the final END.
+// Returns false if the connection failed or the server reported an error.
+bool roundTrip(int fd, std::string &buffer, const std::string &request,
+               std::string &response) {
+  response.clear();
+  if (!MatchProtocol::WriteAll(fd, request))
+    return false;
+
+  std::string line;
+  while (MatchProtocol::ReadLine(fd, buffer, line)) {
+    if (line == "END")
+      return true;
+
+    response += line + "\n";
+    if (line.rfind("ERROR", 0) == 0)
+      return false;
+  }
+  return false;
+}
+
+// Connect, applying the threshold (if one was given) to the connection
+int connectWithThreshold(const std::string socketPath,
+                         const std::string threshold) {
+  int fd = MatchProtocol::Connect(socketPath);
+  if (fd < 0 || threshold == "")
+    return fd;
+
+  std::string buffer, response;
+  if (!roundTrip(fd, buffer, "THRESHOLD " + threshold + "\n", response)) {
+    std::cerr << "unable to set threshold: " << response;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int loadTest(const std::string socketPath, const std::string threshold,
+             const std::vector<std::string> &requests, const int total,
+             const int concurrency) {
+  std::atomic<int> issued = 0;
+  std::atomic<int> failures = 0;
+  std::vector<std::vector<double>> latencies(concurrency);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < concurrency; i++) {
+    threads.push_back(std::thread([&, i] {
+      int fd = connectWithThreshold(socketPath, threshold);
+      if (fd < 0) {
+        failures++;
+        return;
+      }
+
+      std::string buffer, response;
+      int n;
+      while ((n = issued++) < total) {
+        auto before = std::chrono::steady_clock::now();
+        if (!roundTrip(fd, buffer, requests[n % requests.size()], response))
+          failures++;
+        auto elapsed = std::chrono::steady_clock::now() - before;
+        latencies[i].push_back(
+            std::chrono::duration<double, std::milli>(elapsed).count());
+      }
+      close(fd);
+    }));
+  }
+  for (auto &thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  std::vector<double> all;
+  for (auto &l : latencies)
+    all.insert(all.end(), l.begin(), l.end());
+  if (all.empty()) {
+    std::cerr << "no requests completed" << std::endl;
+    return 1;
+  }
+  std::sort(all.begin(), all.end());
+
+  auto percentile = [&all](double p) {
+    return all[std::min(all.size() - 1, (size_t)(p * all.size()))];
+  };
+  std::cout << "requests:   " << all.size() << " (" << failures
+            << " failed)" << std::endl;
+  std::cout << "throughput: " << all.size() / seconds << " req/s"
+            << std::endl;
+  std::cout << "p50:        " << percentile(0.50) << " ms" << std::endl;
+  std::cout << "p99:        " << percentile(0.99) << " ms" << std::endl;
+  std::cout << "max:        " << all.back() << " ms" << std::endl;
+  return failures > 0;
+}
+
+int main(int argc, char **argv) {
+  int ch = 0;
+  std::string socketPath, threshold;
+  bool add = false;
+  bool sendData = false;
+  int total = 0;
+  int concurrency = 1;
+
+  while ((ch = getopt(argc, argv, "S:abd:n:c:")) != -1) {
+    switch (ch) {
+    case 'S':
+      socketPath = optarg;
+      break;
+    case 'a':
+      add = true;
+      break;
+    case 'b':
+      sendData = true;
+      break;
+    case 'd':
+      threshold = optarg;
+      break;
+    case 'n':
+      total = atoi(optarg);
+      break;
+    case 'c':
+      concurrency = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (socketPath == "" || optind >= argc || concurrency < 1 || total < 0)
+    usage();
+
+  std::vector<std::string> requests;
+  for (int i = optind; i < argc; i++)
+    requests.push_back(makeRequest(argv[i], add, sendData));
+
+  if (total > 0)
+    return loadTest(socketPath, threshold, requests, total, concurrency);
+
+  int fd = connectWithThreshold(socketPath, threshold);
+  if (fd < 0) {
+    std::cerr << "unable to connect to " << socketPath << std::endl;
+    return 1;
+  }
+
+  int status = 0;
+  std::string buffer, response;
+  for (auto &request : requests) {
+    if (!roundTrip(fd, buffer, request, response))
+      status = 1;
+    std::cout << response << std::flush;
+  }
+  close(fd);
+  return status;
+}
@@ -0,0 +1,178 @@
+#include "duplicateindex.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QRunnable>
+#include <functional>
+
+// How much of the file to read at a time while indexing
+static const qint64 chunkSize = 1024 * 1024;
+
+class ExistenceTask : public QRunnable
+{
+public:
+    ExistenceTask(std::function<void()> task) : task(task) {}
+    void run() override { task(); }
+
+private:
+    std::function<void()> task;
+};
+
+DuplicateIndex::DuplicateIndex(QObject *parent)
+    : QObject(parent)
+{
+    checkPool.setMaxThreadCount(1);
+}
+
+DuplicateIndex::~DuplicateIndex()
+{
+    stopping.storeRelease(1);
+    checkPool.clear();
+    checkPool.waitForDone();
+    if (scanner) {
+        scanner->wait();
+        delete scanner;
+    }
+}
+
+bool DuplicateIndex::open(QString filename)
+{
+    this->filename = filename;
+    reader.setFileName(filename);
+    if (!reader.open(QIODevice::ReadOnly)) return false;
+
+    scanner = QThread::create([this] { scan(); });
+    scanner->start();
+    return true;
+}
+
+int DuplicateIndex::size()
+{
+    QMutexLocker locker(&indexMutex);
+    return offsets.size();
+}
+
+void DuplicateIndex::scan()
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        finished.storeRelease(1);
+        emit indexed(0);
+        return;
+    }
+
+    // Pairs are arrays at depth 1 in newline delimited JSON, or depth 2 inside
+    // a single top level array. Tell them apart by whether the file starts
+    // with two opening brackets.
+    int pairDepth = 1;
+    {
+        QByteArray start = file.peek(4096).simplified().replace(" ", "");
+        if (start.startsWith("[[")) pairDepth = 2;
+    }
+
+    int depth = 0;
+    bool inString = false, escaped = false;
+    qint64 position = 0, pairStart = 0;
+    QVector<qint64> newOffsets;
+    QVector<quint32> newLengths;
+
+    while (!stopping.loadAcquire()) {
+        QByteArray chunk = file.read(chunkSize);
+        if (chunk.isEmpty()) break;
+
+        for (int i = 0; i < chunk.size(); i++, position++) {
+            char c = chunk.at(i);
+            if (inString) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    inString = false;
+                }
+                continue;
+            }
+
+            if (c == '"') {
+                inString = true;
+            } else if (c == '[') {
+                if (++depth == pairDepth) pairStart = position;
+            } else if (c == ']') {
+                if (depth-- == pairDepth) {
+                    newOffsets.append(pairStart);
+                    newLengths.append(position - pairStart + 1);
+                }
+            }
+        }
+
+        // Publish what we found in this chunk
+        int count;
+        {
+            QMutexLocker locker(&indexMutex);
+            offsets += newOffsets;
+            lengths += newLengths;
+            availabilities.resize(offsets.size());
+            count = offsets.size();
+        }
+        newOffsets.clear();
+        newLengths.clear();
+        emit progress(count);
+    }
+
+    finished.storeRelease(1);
+    emit indexed(size());
+}
+
+bool DuplicateIndex::pair(int i, QString *left, QString *right)
+{
+    qint64 offset;
+    quint32 length;
+    {
+        QMutexLocker locker(&indexMutex);
+        if (i < 0 || i >= offsets.size()) return false;
+        offset = offsets.at(i);
+        length = lengths.at(i);
+    }
+
+    QByteArray data;
+    {
+        QMutexLocker locker(&readerMutex);
+        if (!reader.seek(offset)) return false;
+        data = reader.read(length);
+    }
+
+    QJsonArray imagePair = QJsonDocument::fromJson(data).array();
+    *left = imagePair.at(0).toString();
+    *right = imagePair.at(1).toString();
+    return true;
+}
+
+void DuplicateIndex::checkAhead(int from)
+{
+    // Keep at least a batch worth of checks ahead of the current position
+    int available = size();
+    while (checkedUpTo < from + checkBatchSize && checkedUpTo < available) {
+        int to = qMin(qMax(checkedUpTo, from) + checkBatchSize, available);
+        int start = qMax(checkedUpTo, from);
+        checkPool.start(new ExistenceTask([this, start, to] { checkExistence(start, to); }));
+        checkedUpTo = to;
+    }
+}
+
+void DuplicateIndex::checkExistence(int from, int to)
+{
+    for (int i = from; i < to && !stopping.loadAcquire(); i++) {
+        QString left, right;
+        if (!pair(i, &left, &right)) continue;
+
+        Availability result = QFile::exists(left) && QFile::exists(right) ? Available : Missing;
+        QMutexLocker locker(&indexMutex);
+        availabilities[i] = result;
+    }
+}
+
+DuplicateIndex::Availability DuplicateIndex::availability(int i)
+{
+    QMutexLocker locker(&indexMutex);
+    if (i < 0 || i >= availabilities.size()) return Unknown;
+    return Availability(availabilities.at(i));
+}
@@ -0,0 +1,85 @@
+#ifndef DUPLICATEINDEX_H
+#define DUPLICATEINDEX_H
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+// Index of the pairs in a duplicate list, built incrementally on a background
+// thread so that the first pairs can be shown before the whole file has been
+// read. Only the position of each pair in the file is kept in memory; pairs
+// are read back from the file when needed.
+//
+// Both a single JSON array of pairs and newline delimited JSON (one pair per
+// line) are understood.
+class DuplicateIndex : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Availability { Unknown, Available, Missing };
+
+    DuplicateIndex(QObject *parent = nullptr);
+    ~DuplicateIndex();
+
+    // Start indexing a file. Returns false if it can't be opened.
+    bool open(QString filename);
+
+    // Number of pairs indexed so far
+    int size();
+
+    // Whether the whole file has been indexed
+    bool isFinished() const { return finished.loadAcquire(); }
+
+    // Read a pair back from the file. Safe to call from any thread.
+    bool pair(int i, QString *left, QString *right);
+
+    // Make sure the existence of the files in the pairs following "from" is
+    // being checked in the background.
+    void checkAhead(int from);
+
+    // Result of the background existence check for a pair
+    Availability availability(int i);
+
+signals:
+    // Emitted as pairs are indexed, with the number indexed so far
+    void progress(int count);
+
+    // Emitted once the whole file has been indexed
+    void indexed(int count);
+
+private:
+    // Runs on the indexing thread
+    void scan();
+
+    // Check the files for a range of pairs exist
+    void checkExistence(int from, int to);
+
+    QString filename;
+    QThread *scanner = nullptr;
+    QAtomicInt finished;
+    QAtomicInt stopping;
+
+    // Position and length of each pair in the file, and whether its files
+    // exist (as an Availability)
+    QMutex indexMutex;
+    QVector<qint64> offsets;
+    QVector<quint32> lengths;
+    QVector<quint8> availabilities;
+
+    // For reading pairs back
+    QMutex readerMutex;
+    QFile reader;
+
+    // Existence checks are done in batches on a single thread, so as not to
+    // hammer the disk
+    QThreadPool checkPool;
+    int checkedUpTo = 0;
+    const int checkBatchSize = 256;
+};
+
+#endif // DUPLICATEINDEX_H
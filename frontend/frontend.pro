@@ -16,10 +16,16 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    duplicateindex.cpp \
     main.cpp \
+    photocache.cpp \
+    reviewlog.cpp \
     widget.cpp
 
 HEADERS += \
+    duplicateindex.h \
+    photocache.h \
+    reviewlog.h \
     widget.h
 
 FORMS += \
@@ -0,0 +1,210 @@
+#include "photocache.h"
+#include <QBuffer>
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QImageReader>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QRunnable>
+#include <QTemporaryFile>
+
+// Cache size in kilobytes of decoded image data
+static const int cacheSizeKB = 512 * 1024;
+
+class DecodeTask : public QRunnable
+{
+public:
+    DecodeTask(PhotoCache *cache, QString path, QSize displaySize)
+        : cache(cache), path(path), displaySize(displaySize) {}
+
+    void run() override
+    {
+        cache->insert(path, PhotoCache::decode(path, displaySize));
+    }
+
+private:
+    PhotoCache *cache;
+    QString path;
+    QSize displaySize;
+};
+
+PhotoCache::PhotoCache()
+    : cache(cacheSizeKB)
+    , displaySize(1024, 1024)
+{
+}
+
+PhotoCache::~PhotoCache()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+void PhotoCache::setDisplaySize(QSize size)
+{
+    QMutexLocker locker(&mutex);
+    displaySize = size;
+}
+
+void PhotoCache::prefetch(QString path)
+{
+    QMutexLocker locker(&mutex);
+    if (cache.contains(path) || inFlight.contains(path)) return;
+
+    inFlight.insert(path);
+    pool.start(new DecodeTask(this, path, displaySize));
+}
+
+Photo PhotoCache::get(QString path, bool *hit)
+{
+    QMutexLocker locker(&mutex);
+
+    // Wait for a prefetch which is already under way
+    *hit = !inFlight.contains(path);
+    while (inFlight.contains(path)) {
+        decoded.wait(&mutex);
+    }
+
+    if (cache.contains(path)) {
+        return *cache.object(path);
+    }
+
+    // Not prefetched, or it has already been evicted
+    *hit = false;
+    QSize size = displaySize;
+    locker.unlock();
+    Photo photo = decode(path, size);
+    locker.relock();
+    cache.insert(path, new Photo(photo), photo.image.sizeInBytes() / 1024);
+    return photo;
+}
+
+void PhotoCache::remove(QString path)
+{
+    QMutexLocker locker(&mutex);
+    cache.remove(path);
+}
+
+void PhotoCache::insert(QString path, Photo photo)
+{
+    QMutexLocker locker(&mutex);
+    cache.insert(path, new Photo(photo), photo.image.sizeInBytes() / 1024);
+    inFlight.remove(path);
+    decoded.wakeAll();
+}
+
+// CR2 files are TIFF based, and the first IFD describes a full size JPEG
+// preview of the raw image (via the strip offset and byte count tags), which
+// can be decoded directly. Returns an empty array if it can't be found.
+static QByteArray extractCr2Preview(QString path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+
+    QDataStream stream(&file);
+    QByteArray order = file.read(2);
+    if (order == "II") {
+        stream.setByteOrder(QDataStream::LittleEndian);
+    } else if (order == "MM") {
+        stream.setByteOrder(QDataStream::BigEndian);
+    } else {
+        return QByteArray();
+    }
+
+    quint16 magic;
+    quint32 ifdOffset;
+    stream >> magic >> ifdOffset;
+    if (magic != 42 || !file.seek(ifdOffset)) return QByteArray();
+
+    quint16 entries;
+    stream >> entries;
+    quint32 previewOffset = 0, previewLength = 0;
+    for (int i = 0; i < entries && stream.status() == QDataStream::Ok; i++) {
+        quint16 tag, type;
+        quint32 count, value;
+        stream >> tag >> type >> count >> value;
+
+        // SHORT values are stored in the first two bytes of the value field
+        if (type == 3) {
+            value = stream.byteOrder() == QDataStream::LittleEndian ? (value & 0xffff) : (value >> 16);
+        }
+
+        if (tag == 0x0111) previewOffset = value;  // StripOffsets
+        if (tag == 0x0117) previewLength = value;  // StripByteCounts
+    }
+
+    if (previewOffset == 0 || previewLength == 0 || !file.seek(previewOffset)) return QByteArray();
+    return file.read(previewLength);
+}
+
+// Fallback for CR2 files we couldn't extract a preview from. Runs ImageMagick
+// to convert to a temporary JPEG.
+static QImage convertWithImageMagick(QString path)
+{
+    qDebug() << "Attempting to convert to jpg: " << path;
+
+    // Create a temporary filename to convert to
+    QTemporaryFile tempFile;
+    tempFile.setFileTemplate(tempFile.fileTemplate().append(".jpg"));
+    tempFile.open(); // tempfile name is only created here
+    tempFile.close(); // close as we don't need to write to it directly
+    QString command = QString("/usr/local/bin/convert %1 %2").arg(path).arg(tempFile.fileName());
+
+    // Run the conversion process.
+    // Need to add /usr/local/bin to the environment of the app so that
+    // image conversation utilities can be found later.
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("PATH", "/usr/local/bin");
+    QProcess process;
+    process.setProcessEnvironment(env);
+    qDebug() << "Running: " << command;
+    process.start(command);
+    if (!process.waitForFinished()) {
+        qDebug() << "Command did not finish successfully";
+    }
+
+    // Tempfile should now contain the converted image. It will be cleaned up on
+    // the destructor of the QTemporaryFile object.
+    return QImage(tempFile.fileName());
+}
+
+// Reads an image, letting the decoder scale it down while decoding where it
+// can (which is much faster for JPEGs than decoding at full size).
+static Photo readScaled(QImageReader &reader, QSize displaySize)
+{
+    Photo photo;
+    reader.setAutoTransform(true);
+    photo.originalSize = reader.size();
+    if (photo.originalSize.isValid() &&
+        (photo.originalSize.width() > displaySize.width() || photo.originalSize.height() > displaySize.height())) {
+        reader.setScaledSize(photo.originalSize.scaled(displaySize, Qt::KeepAspectRatio));
+    }
+    photo.image = reader.read();
+    return photo;
+}
+
+Photo PhotoCache::decode(QString path, QSize displaySize)
+{
+    // Everything but CR2 raw format
+    if (!path.endsWith(".CR2", Qt::CaseInsensitive)) {
+        QImageReader reader(path);
+        return readScaled(reader, displaySize);
+    }
+
+    QByteArray preview = extractCr2Preview(path);
+    if (!preview.isEmpty()) {
+        QBuffer buffer(&preview);
+        QImageReader reader(&buffer, "jpeg");
+        Photo photo = readScaled(reader, displaySize);
+        if (!photo.image.isNull()) return photo;
+    }
+
+    Photo photo;
+    photo.image = convertWithImageMagick(path);
+    photo.originalSize = photo.image.size();
+    if (photo.image.width() > displaySize.width() || photo.image.height() > displaySize.height()) {
+        photo.image = photo.image.scaled(displaySize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return photo;
+}
@@ -0,0 +1,63 @@
+#ifndef PHOTOCACHE_H
+#define PHOTOCACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+// A decoded photo, scaled down for display, along with the resolution of the
+// original image (for the metadata display).
+struct Photo
+{
+    QImage image;
+    QSize originalSize;
+};
+
+// Decodes photos on a background thread pool ahead of time and keeps the
+// results in a bounded LRU cache, so that moving to the next pair doesn't
+// have to wait for decoding.
+class PhotoCache
+{
+public:
+    PhotoCache();
+    ~PhotoCache();
+
+    // Size that photos are scaled down to fit within when decoded.
+    void setDisplaySize(QSize size);
+
+    // Start decoding a photo in the background if it isn't already cached or
+    // being decoded.
+    void prefetch(QString path);
+
+    // Returns the decoded photo, waiting for a background decode if one is
+    // in progress, or decoding it now if it was never prefetched. hit is set
+    // to whether the photo was already available.
+    Photo get(QString path, bool *hit);
+
+    // Forget a photo (e.g. because it has been deleted).
+    void remove(QString path);
+
+    // Decodes a photo, scaled to fit within the given size. This wraps the
+    // logic that extracts the preview image from CR2 files.
+    static Photo decode(QString path, QSize displaySize);
+
+private:
+    // Called from the decoding threads when a photo is ready
+    void insert(QString path, Photo photo);
+
+    friend class DecodeTask;
+
+    QThreadPool pool;
+    QMutex mutex;
+    QWaitCondition decoded;
+    QCache<QString, Photo> cache;
+    QSet<QString> inFlight;
+    QSize displaySize;
+};
+
+#endif // PHOTOCACHE_H
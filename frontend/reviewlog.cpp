@@ -0,0 +1,65 @@
+#include "reviewlog.h"
+#include <QDateTime>
+#include <QFileInfo>
+#include <QTextStream>
+
+// The first line is "list TAB <size> TAB <modification time>" for the duplicate
+// list. Each line after it is "<pair index> TAB skip" or
+// "<pair index> TAB delete TAB <path>"
+
+bool ReviewLog::open(QString duplicateFilename)
+{
+    QString identity = identify(duplicateFilename);
+    bool fresh = true;
+
+    file.setFileName(duplicateFilename + ".review");
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        QString line;
+        if (in.readLineInto(&line) && line == identity) fresh = false;
+        while (!fresh && in.readLineInto(&line)) {
+            QStringList fields = line.split('\t');
+            if (fields.size() < 2) continue;
+
+            position = qMax(position, fields.at(0).toInt() + 1);
+            if (fields.at(1) == "delete" && fields.size() == 3) deletedPaths.insert(fields.at(2));
+        }
+        file.close();
+
+        // The pair indexes in the log don't apply to a list that has changed
+        if (fresh) {
+            QFile::remove(file.fileName() + ".old");
+            file.rename(file.fileName() + ".old");
+            file.setFileName(duplicateFilename + ".review");
+        }
+    }
+
+    if (!file.open(QIODevice::Append | QIODevice::Text)) return false;
+    if (fresh) write(identity);
+    return true;
+}
+
+QString ReviewLog::identify(QString duplicateFilename)
+{
+    QFileInfo info(duplicateFilename);
+    return QString("list\t%1\t%2").arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+}
+
+void ReviewLog::recordSkip(int index)
+{
+    write(QString("%1\tskip").arg(index));
+    position = qMax(position, index + 1);
+}
+
+void ReviewLog::recordDelete(int index, QString filename)
+{
+    write(QString("%1\tdelete\t%2").arg(index).arg(filename));
+    position = qMax(position, index + 1);
+    deletedPaths.insert(filename);
+}
+
+void ReviewLog::write(QString line)
+{
+    file.write(line.toUtf8() + "\n");
+    file.flush();
+}
@@ -0,0 +1,40 @@
+#ifndef REVIEWLOG_H
+#define REVIEWLOG_H
+
+#include <QFile>
+#include <QSet>
+#include <QString>
+
+// Records the decision made for each pair in a duplicate list, in a file next
+// to the list, so that reviewing can be resumed where it was left off.
+class ReviewLog
+{
+public:
+    // Opens the log for the given duplicate list, reading back any previous
+    // decisions. A log left from a different version of the list is moved
+    // aside to <list>.review.old and a new one started. Returns false if the
+    // log can't be written.
+    bool open(QString duplicateFilename);
+
+    // Index of the first pair without a decision
+    int resumePosition() const { return position; }
+
+    // Files deleted so far, including during previous reviews
+    const QSet<QString> &deletedFiles() const { return deletedPaths; }
+
+    void recordSkip(int index);
+    void recordDelete(int index, QString filename);
+
+private:
+    // Size and modification time of the duplicate list, recorded on the first
+    // line of the log
+    static QString identify(QString duplicateFilename);
+
+    void write(QString line);
+
+    QFile file;
+    int position = 0;
+    QSet<QString> deletedPaths;
+};
+
+#endif // REVIEWLOG_H
@@ -3,12 +3,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QDir>
-#include <QJsonDocument>
-#include <QJsonArray>
 #include <QTime>
-#include <QTemporaryFile>
-#include <QProcess>
-#include <QProcessEnvironment>
 #include <QDebug>
 
 Widget::Widget(QWidget *parent)
@@ -25,6 +20,9 @@ Widget::Widget(QWidget *parent)
     ui->leftImage->setScaledContents(true);
     ui->rightImage->setPixmap(rightPlaceholderImage);
     ui->rightImage->setScaledContents(true);
+
+    connect(&duplicateIndex, &DuplicateIndex::progress, this, &Widget::pairsIndexed);
+    connect(&duplicateIndex, &DuplicateIndex::indexed, this, &Widget::pairsIndexed);
 }
 
 Widget::~Widget()
@@ -46,31 +44,52 @@ void Widget::on_selectFileButton_clicked()
     ui->statusLabel->setText(QString("Loading input from %1").arg(filename));
     ui->selectFileButton->setEnabled(false);
 
-    // Open and read the JSON document
-    parseDuplicateFile(filename);
-    totalComparisons = jsonDuplicateArray.size();
-    ui->statusLabel->setText(QString("JSON input data loaded - %1 potential duplicates to inspect").arg(totalComparisons));
-    ui->progressBar->setRange(0,totalComparisons);
+    // Start indexing the JSON document in the background. Pairs can be shown
+    // as soon as they have been indexed.
+    if (!duplicateIndex.open(filename)) {
+        QMessageBox::critical(this, "Error", "Unable to read JSON file");
+        ui->selectFileButton->setEnabled(true);
+        return;
+    }
 
-    // Start the comparison process and enable the buttons
+    // Pick up where the last review of this file left off
+    if (!reviewLog.open(filename)) {
+        QMessageBox::warning(this, "Warning", "Unable to record progress, it will be lost on exit");
+    }
+    completedComparisons = reviewLog.resumePosition();
+    qDebug() << "Resuming from comparison " << completedComparisons;
+
+    // Start the comparison process
     loadNextPair();
-    ui->deleteLeftButton->setEnabled(true);
-    ui->deleteRightButton->setEnabled(true);
-    ui->skipButton->setEnabled(true);
 }
 
-void Widget::parseDuplicateFile(QString filename)
+void Widget::pairsIndexed(int count)
 {
-    QFile jsonFile(filename);
-    bool success = jsonFile.open(QIODevice::ReadOnly | QIODevice::Text);
-    if (!success) {
-        QMessageBox::critical(this, "Error", "Unable to read JSON file");
-        throw "unable to read " + filename;
+    totalComparisons = count;
+    ui->progressBar->setRange(0, totalComparisons);
+    ui->progressBar->setValue(completedComparisons);
+
+    if (waitingForPairs) {
+        loadNextPair();
     }
+}
 
-    QByteArray data = jsonFile.readAll();
-    QJsonDocument document = QJsonDocument::fromJson(data);
-    jsonDuplicateArray = document.array();
+bool Widget::isPairAvailable(int index, QString leftPath, QString rightPath)
+{
+    // Deleted by us, so the background check may be out of date
+    if (reviewLog.deletedFiles().contains(leftPath) || reviewLog.deletedFiles().contains(rightPath)) {
+        return false;
+    }
+
+    switch (duplicateIndex.availability(index)) {
+    case DuplicateIndex::Available:
+        return true;
+    case DuplicateIndex::Missing:
+        return false;
+    default:
+        // The background check hasn't got here yet
+        return QFile::exists(leftPath) && QFile::exists(rightPath);
+    }
 }
 
 void Widget::loadNextPair()
@@ -78,18 +97,27 @@ void Widget::loadNextPair()
     QTime t;
     t.start();
     ui->statusLabel->setText("Loading images...");
+    waitingForPairs = false;
 
     // Loop until we find a pair of images that exists (in case I've already deleted one).
     QString leftPath, rightPath;
     while(true) {
-        QJsonArray imagePair = jsonDuplicateArray.at(completedComparisons).toArray();
-        leftPath = imagePair.at(0).toString();
-        rightPath = imagePair.at(1).toString();
+        duplicateIndex.checkAhead(completedComparisons);
+
+        // Out of pairs, either for now or for good
+        if (!duplicateIndex.pair(completedComparisons, &leftPath, &rightPath)) {
+            setButtonsEnabled(false);
+            if (duplicateIndex.isFinished() && completedComparisons >= duplicateIndex.size()) {
+                ui->statusLabel->setText(QString("All %1 comparisons done.").arg(duplicateIndex.size()));
+            } else {
+                ui->statusLabel->setText("Waiting for more of the input to be read...");
+                waitingForPairs = true;
+            }
+            return;
+        }
 
         // If both files exist, proceed to loading them into the UI.
-        auto leftExists = QFile::exists(leftPath);
-        auto rightExists = QFile::exists(rightPath);
-        if (leftExists && rightExists) {
+        if (isPairAvailable(completedComparisons, leftPath, rightPath)) {
             break;
         }
 
@@ -99,31 +127,40 @@ void Widget::loadNextPair()
         ui->progressBar->setValue(completedComparisons);
     }
 
-    // Try to load the images and hope they are understandable by Qt
-    QPixmap leftImage = loadPhoto(leftPath);
-    QPixmap rightImage = loadPhoto(rightPath);
+    // Decode both images, hopefully already done in the background
+    photoCache.setDisplaySize(ui->leftImage->size().expandedTo(ui->rightImage->size()) * devicePixelRatioF());
+    bool leftHit, rightHit;
+    Photo leftPhoto = photoCache.get(leftPath, &leftHit);
+    Photo rightPhoto = photoCache.get(rightPath, &rightHit);
 
     // Display some metadata about the files to help in delete selection
-    displayPhotoMetadata(leftPath, leftImage, rightPath, rightImage);
+    displayPhotoMetadata(leftPath, leftPhoto.originalSize, rightPath, rightPhoto.originalSize);
 
     qDebug() << "Images: " << leftPath << " <=> " << rightPath;
 
-    ui->leftImage->setPixmap(leftImage);
+    ui->leftImage->setPixmap(QPixmap::fromImage(leftPhoto.image));
     ui->leftImage->setScaledContents(true);
-    ui->rightImage->setPixmap(rightImage);
+    ui->rightImage->setPixmap(QPixmap::fromImage(rightPhoto.image));
     ui->rightImage->setScaledContents(true);
 
     // Calculate loading duration.
-    QString loadDuration = QString("Loaded images in %1 ms").arg(t.elapsed());
+    QString loadDuration = QString("Loaded images in %1 ms (cache %2/%3)")
+            .arg(t.elapsed())
+            .arg(leftHit ? "hit" : "miss")
+            .arg(rightHit ? "hit" : "miss");
     qDebug() << loadDuration;
 
     // Increment the completed count and progress bar
     completedComparisons++;
     ui->progressBar->setValue(completedComparisons);
+
+    // Get the next few pairs ready while this one is being looked at
+    prefetchNextPairs();
+    setButtonsEnabled(true);
     ui->statusLabel->setText(QString("%1. Comparison %2/%3.").arg(loadDuration).arg(completedComparisons).arg(totalComparisons));
 }
 
-void Widget::displayPhotoMetadata(QString leftFilename, QPixmap left, QString rightFilename, QPixmap right)
+void Widget::displayPhotoMetadata(QString leftFilename, QSize left, QString rightFilename, QSize right)
 {
     // filenames
     ui->leftFilenameLineEdit->setText(leftFilename);
@@ -134,65 +171,58 @@ void Widget::displayPhotoMetadata(QString leftFilename, QPixmap left, QString ri
     ui->rightSizeLineEdit->setText(QString("%1 bytes").arg(QFileInfo(rightFilename).size()));
 
     // file resolutions
-    ui->leftResolutionLineEdit->setText(QString("%1 x %2").arg(left.size().width()).arg(left.size().height()));
-    ui->rightResolutionLineEdit->setText(QString("%1 x %2").arg(right.size().width()).arg(right.size().height()));
+    ui->leftResolutionLineEdit->setText(QString("%1 x %2").arg(left.width()).arg(left.height()));
+    ui->rightResolutionLineEdit->setText(QString("%1 x %2").arg(right.width()).arg(right.height()));
 }
 
-QPixmap Widget::loadPhoto(QString path) const
+void Widget::prefetchNextPairs()
 {
-    // Everything but CR2 raw format
-    if (!path.endsWith(".CR2", Qt::CaseInsensitive)) {
-        return QPixmap(path);
-    }
-    qDebug() << "Attempting to convert to jpg: " << path;
-
-    // Create a temporary filename to convert to
-    QTemporaryFile tempFile;
-    tempFile.setFileTemplate(tempFile.fileTemplate().append(".jpg"));
-    tempFile.open(); // tempfile name is only created here
-    tempFile.close(); // close as we don't need to write to it directly
-    QString command = QString("/usr/local/bin/convert %1 %2").arg(path).arg(tempFile.fileName());
-
-    // Run the conversion process.
-    // Need to add /usr/local/bin to the environment of the app so that
-    // image conversation utilities can be found later.
-    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-    env.insert("PATH", "/usr/local/bin");
-    QProcess process;
-    process.setProcessEnvironment(env);
-    qDebug() << "Running: " << command;
-    process.start(command);
-    if (!process.waitForFinished()) {
-        qDebug() << "Command did not finish successfully";
+    QString leftPath, rightPath;
+    for (int i = completedComparisons; i < completedComparisons + prefetchPairs; i++) {
+        if (!duplicateIndex.pair(i, &leftPath, &rightPath)) break;
+        photoCache.prefetch(leftPath);
+        photoCache.prefetch(rightPath);
     }
-
-    // Tempfile should now contain the converted image. It will be cleaned up on
-    // the destructor of the QTemporaryFile object.
-    return QPixmap(tempFile.fileName());
 }
 
 void Widget::on_skipButton_clicked()
 {
     qDebug() << "Image index " << QString::number(completedComparisons-1) << " skipped...";
+    reviewLog.recordSkip(completedComparisons-1);
     loadNextPair();
 }
 
 void Widget::on_deleteLeftButton_clicked()
 {
     // use the filename from the metadata LineEdit
-    QString filename = ui->leftFilenameLineEdit->text();
-
-    qDebug() << "Requested to delete " << filename;
-    QFile::remove(filename);
-    loadNextPair();
+    deletePhoto(ui->leftFilenameLineEdit->text());
 }
 
 void Widget::on_deleteRightButton_clicked()
 {
     // use the filename from the metadata LineEdit
-    QString filename = ui->rightFilenameLineEdit->text();
+    deletePhoto(ui->rightFilenameLineEdit->text());
+}
 
+void Widget::deletePhoto(QString filename)
+{
     qDebug() << "Requested to delete " << filename;
-    QFile::remove(filename);
+
+    // Stay on this pair if the file couldn't be deleted, so it isn't recorded
+    // as gone
+    QFile file(filename);
+    if (!file.remove()) {
+        QMessageBox::critical(this, "Error", QString("Unable to delete %1: %2").arg(filename, file.errorString()));
+        return;
+    }
+    photoCache.remove(filename);
+    reviewLog.recordDelete(completedComparisons-1, filename);
     loadNextPair();
 }
+
+void Widget::setButtonsEnabled(bool enabled)
+{
+    ui->deleteLeftButton->setEnabled(enabled);
+    ui->deleteRightButton->setEnabled(enabled);
+    ui->skipButton->setEnabled(enabled);
+}
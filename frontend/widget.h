@@ -2,10 +2,9 @@
 #define WIDGET_H
 
 #include <QWidget>
-#include <QJsonArray>
-
-// forward declarations
-class QPixmap;
+#include "duplicateindex.h"
+#include "photocache.h"
+#include "reviewlog.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class Widget; }
@@ -28,19 +27,35 @@ private slots:
 
     void on_deleteRightButton_clicked();
 
+    // Called as the duplicate list is indexed in the background
+    void pairsIndexed(int count);
+
 private:
-    void parseDuplicateFile(QString filename);
     void loadNextPair();
-    void displayPhotoMetadata(QString leftFilename, QPixmap left, QString rightFilename, QPixmap right);
 
-    // Loads an image from a given path and returns it
-    // This wraps the logic that converts CR2 images to something Qt can understand.
-    QPixmap loadPhoto(QString path) const;
+    // Whether both files of a pair (still) exist
+    bool isPairAvailable(int index, QString leftPath, QString rightPath);
+
+    // Deletes a file and records the decision
+    void deletePhoto(QString filename);
+
+    void setButtonsEnabled(bool enabled);
+    void displayPhotoMetadata(QString leftFilename, QSize left, QString rightFilename, QSize right);
+
+    // Starts decoding the pairs following the current one in the background
+    void prefetchNextPairs();
 
     Ui::Widget *ui;
 
-    QJsonArray jsonDuplicateArray;
+    PhotoCache photoCache;
+    const int prefetchPairs = 4;
+
+    DuplicateIndex duplicateIndex;
+    ReviewLog reviewLog;
     int completedComparisons = 0;
     int totalComparisons = 0;
+
+    // Set when we've run out of indexed pairs before indexing has finished
+    bool waitingForPairs = false;
 };
 #endif // WIDGET_H
@@ -1,23 +1,55 @@
 #include <boost/filesystem.hpp>
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <optional>
+#include <set>
 #include <thread>
 
 #include "DirectoryWalker.hpp"
 #include "FingerprintStore.hpp"
+#include "MatchServer.hpp"
 #include "Util.hpp"
 
 void usage() {
   std::cerr << "photo-fingerprint:" << std::endl << std::endl;
   std::cerr << " Generate fingerprints:" << std::endl;
   std::cerr << " -g -s <source image directory> -d <destination directory for "
-               "fingerprints>"
+               "fingerprints> [-w [-x]]"
+            << std::endl;
+  std::cerr << "   -G <size> and -L <rgb|gray|yuv420> set the fingerprint "
+               "format (default: as recorded in the destination, or 100 rgb)"
+            << std::endl;
+  std::cerr << "   -w keeps watching the source directory for new files"
+            << std::endl;
+  std::cerr << "   -x also reports new files which duplicate existing ones"
             << std::endl;
   std::cerr << std::endl;
   std::cerr << " Find duplicates:" << std::endl;
   std::cerr << " -f -s <fingerprint source dir> -d <image dir to be searched> "
                "-u <fuzz factor>"
             << std::endl;
+  std::cerr << std::endl;
+  std::cerr << " Serve match requests (see photo-fingerprint-client):"
+            << std::endl;
+  std::cerr << " -S <socket path> -s <fingerprint source dir> -u <fuzz factor> "
+               "[-B <max batch size>]"
+            << std::endl;
+  std::cerr << std::endl;
+  std::cerr << " Merge results of sharded runs:" << std::endl;
+  std::cerr << " -M <partial result file>..." << std::endl;
+  std::cerr << std::endl;
+  std::cerr << " Options:" << std::endl;
+  std::cerr << " -t <number of threads>" << std::endl;
+  std::cerr << " -j <journal file> (record progress, and resume from it if "
+               "it already exists)"
+            << std::endl;
+  std::cerr << " -k <shard>/<count> (only handle one shard of the files, "
+               "numbered from 0)"
+            << std::endl;
+  std::cerr << " -p (split the fingerprints rather than the files between "
+               "shards)"
+            << std::endl;
   exit(1);
 }
 
@@ -32,17 +64,49 @@ bool isDirectoryValid(std::string directory) {
   return true;
 }
 
+// Combine the results of sharded runs into a single deduplicated list, in a
+// deterministic order.
+int mergeResults(const std::vector<std::string> files) {
+  std::set<std::string> lines;
+  for (auto &file : files) {
+    std::ifstream in(file);
+    if (!in) {
+      std::cerr << "unable to read " << file << std::endl;
+      return 1;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line != "")
+        lines.insert(line);
+    }
+  }
+
+  for (auto &line : lines)
+    std::cout << line << std::endl;
+  return 0;
+}
+
 int main(int argc, char **argv) {
   // Option handling
   int ch = 0;
-  std::string srcDirectory, dstDirectory;
+  std::string srcDirectory, dstDirectory, journalPath, socketPath;
+  std::string fingerprintSize, fingerprintLayout; // empty unless given
   bool generateMode = false;
   bool findDuplicateMode = false;
   bool metadataMode = false;
+  bool serveMode = false;
+  bool mergeMode = false;
+  int shardIndex = 0, shardCount = 1;
+  bool shardFingerprints = false;
+  bool sharded = false;
+  bool watchMode = false;
+  bool watchFindDuplicates = false;
   int numThreads = std::thread::hardware_concurrency();
   int fuzzFactor = 0;
+  int maxBatchSize = 1;
 
-  while ((ch = getopt(argc, argv, "mgfd:s:t:u:")) != -1) {
+  while ((ch = getopt(argc, argv, "mgfwxMpd:s:t:u:j:S:G:L:k:B:")) != -1) {
     switch (ch) {
     case 'm':
       metadataMode = true;
@@ -53,6 +117,12 @@ int main(int argc, char **argv) {
     case 'f':
       findDuplicateMode = true;
       break;
+    case 'w':
+      watchMode = true;
+      break;
+    case 'x':
+      watchFindDuplicates = true;
+      break;
     case 's':
       srcDirectory = optarg;
       break;
@@ -65,13 +135,74 @@ int main(int argc, char **argv) {
     case 'u':
       fuzzFactor = atoi(optarg);
       break;
+    case 'j':
+      journalPath = optarg;
+      break;
+    case 'G':
+      fingerprintSize = optarg;
+      break;
+    case 'L':
+      fingerprintLayout = optarg;
+      break;
+    case 'S':
+      serveMode = true;
+      socketPath = optarg;
+      break;
+    case 'M':
+      mergeMode = true;
+      break;
+    case 'B':
+      maxBatchSize = atoi(optarg);
+      break;
+    case 'k':
+      if (sscanf(optarg, "%d/%d", &shardIndex, &shardCount) != 2)
+        usage();
+      sharded = true;
+      break;
+    case 'p':
+      shardFingerprints = true;
+      break;
     default:
       usage();
     }
   }
 
   // Only one mode can be selected
-  if (generateMode + findDuplicateMode + metadataMode != 1)
+  if (generateMode + findDuplicateMode + metadataMode + serveMode +
+          mergeMode !=
+      1)
+    usage();
+
+  // Sharding splits the files for -g, -m and -f, or with -p the fingerprints
+  // loaded for -f and -S. Anywhere else every shard would do all of the work.
+  // Watching with -x can't be sharded either: each shard would only see the
+  // new fingerprints from its own files, and miss duplicates across shards.
+  if (shardFingerprints && !(sharded && (findDuplicateMode || serveMode))) {
+    std::cerr << "-p needs -k, and only applies to -f and -S" << std::endl;
+    usage();
+  }
+  if (sharded && (mergeMode || (serveMode && !shardFingerprints))) {
+    std::cerr << "-k only applies to -g, -m and -f, or to -S with -p"
+              << std::endl;
+    usage();
+  }
+  if (sharded && watchFindDuplicates) {
+    std::cerr << "-k can't be used with -x" << std::endl;
+    usage();
+  }
+
+  // Merging only needs the partial result files
+  if (mergeMode) {
+    if (optind >= argc)
+      usage();
+    return mergeResults(std::vector<std::string>(argv + optind, argv + argc));
+  }
+
+  if (shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount)
+    usage();
+
+  // Watching is only supported when generating
+  if ((watchMode && !generateMode) || (watchFindDuplicates && !watchMode))
     usage();
 
   // Generate and find duplicate modes require two directories
@@ -79,8 +210,26 @@ int main(int argc, char **argv) {
       (srcDirectory == "" || dstDirectory == ""))
     usage();
 
-  // Check for a sensible number of threads
-  if (numThreads < 1)
+  // Check the fingerprint format is one we have kernels for. Without -G or
+  // -L, generating carries on in the format the destination already uses.
+  // Other modes always use the format recorded with the fingerprints.
+  std::optional<FingerprintFormat> format;
+  if (fingerprintSize != "" || fingerprintLayout != "") {
+    if (!generateMode) {
+      std::cerr << "-G and -L only apply to -g" << std::endl;
+      usage();
+    }
+    format = FingerprintFormat::Parse(
+        fingerprintSize != "" ? fingerprintSize : "100",
+        fingerprintLayout != "" ? fingerprintLayout : "rgb");
+    if (!format.has_value()) {
+      std::cerr << "Unsupported fingerprint format" << std::endl;
+      usage();
+    }
+  }
+
+  // Check for a sensible number of threads and batch size
+  if (numThreads < 1 || maxBatchSize < 1)
     usage();
   std::cerr << "Using " << numThreads << " threads of maximum "
             << std::thread::hardware_concurrency() << std::endl;
@@ -90,27 +239,52 @@ int main(int argc, char **argv) {
     return 1;
 
   FingerprintStore fs(srcDirectory);
+  fs.SetShard(shardIndex, shardCount, shardFingerprints);
   WorkerOptions options = {numThreads, fuzzFactor, dstDirectory};
+  options.JournalPath = journalPath;
 
-  if (metadataMode) {
-    options.WType = MetadataWorker;
-    fs.RunWorkers(options);
-    return 0;
-  }
+  try {
+    if (metadataMode) {
+      options.WType = MetadataWorker;
+      fs.RunWorkers(options);
+      return 0;
+    }
 
-  // Remaining modes require a destination directory
-  if (!isDirectoryValid(dstDirectory))
-    return 1;
+    if (serveMode) {
+      fs.Load();
+      MatchServer server(&fs, socketPath, numThreads, fuzzFactor,
+                         maxBatchSize);
+      server.Run();
+      return 1;
+    }
 
-  if (generateMode) {
-    options.WType = GenerateWorker;
-    fs.RunWorkers(options);
-  }
+    // Remaining modes require a destination directory
+    if (!isDirectoryValid(dstDirectory))
+      return 1;
 
-  if (findDuplicateMode) {
-    options.WType = FingerprintWorker;
-    fs.Load();
-    fs.RunWorkers(options);
+    if (generateMode) {
+      fs.SetFormat(format.has_value() ? format.value()
+                                      : FingerprintFormat::Read(dstDirectory));
+    }
+
+    if (generateMode && watchMode) {
+      fs.Watch(options, watchFindDuplicates);
+      return 0;
+    }
+
+    if (generateMode) {
+      options.WType = GenerateWorker;
+      fs.RunWorkers(options);
+    }
+
+    if (findDuplicateMode) {
+      options.WType = FingerprintWorker;
+      fs.Load();
+      fs.RunWorkers(options);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
   }
 
   return 0;
@@ -0,0 +1,84 @@
+#!/bin/sh
+# Checks that sharded duplicate searches give the same result as a single run.
+#
+# Generates a small store from synthetic images (some distinct, some exact or
+# re-encoded copies), runs -f once unsharded and once per shard with -k i/K,
+# both splitting the files and (-p) the fingerprints, and compares the merged
+# results. Exits non-zero on any difference.
+#
+# Usage: tests/shard_check.sh <photo-fingerprint binary> [shard count]
+# Needs ImageMagick's command line tools to create the images.
+
+set -eu
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 <photo-fingerprint binary> [shard count]" >&2
+  exit 2
+fi
+bin=$1
+shards=${2:-3}
+
+if command -v magick >/dev/null 2>&1; then
+  convert="magick"
+elif command -v convert >/dev/null 2>&1; then
+  convert="convert"
+else
+  echo "ImageMagick command line tools not found" >&2
+  exit 2
+fi
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+images="$work/images"
+fingerprints="$work/fingerprints/"
+mkdir -p "$images/a" "$images/b/c" "$fingerprints"
+
+# Distinct images, spread over subdirectories so the shard hash sees
+# different relative paths
+for i in 1 2 3 4 5 6 7 8; do
+  case $i in
+  1 | 2 | 3) dir="$images/a" ;;
+  4 | 5) dir="$images/b" ;;
+  *) dir="$images/b/c" ;;
+  esac
+  $convert -size 64x64 -seed $i plasma:fractal "$dir/plasma$i.png"
+done
+
+# Duplicates: exact copies and re-encoded versions
+cp "$images/a/plasma1.png" "$images/b/copy1.png"
+cp "$images/b/plasma4.png" "$images/b/c/copy4.png"
+$convert "$images/a/plasma2.png" -quality 95 "$images/b/c/jpeg2.jpg"
+$convert "$images/b/c/plasma7.png" -quality 95 "$images/a/jpeg7.jpg"
+
+"$bin" -g -t 2 -s "$images" -d "$fingerprints" >/dev/null 2>&1
+
+"$bin" -f -t 2 -s "$fingerprints" -d "$images" >"$work/single.txt" 2>/dev/null
+"$bin" -M "$work/single.txt" >"$work/expected.txt"
+if [ ! -s "$work/expected.txt" ]; then
+  echo "the single run found no duplicates, nothing to compare" >&2
+  exit 1
+fi
+
+status=0
+for split in files fingerprints; do
+  flags=""
+  [ $split = fingerprints ] && flags="-p"
+
+  i=0
+  while [ $i -lt "$shards" ]; do
+    "$bin" -f -t 2 -s "$fingerprints" -d "$images" -k $i/"$shards" $flags \
+      >"$work/part$i.txt" 2>/dev/null
+    i=$((i + 1))
+  done
+
+  "$bin" -M "$work"/part*.txt >"$work/merged.txt"
+  if diff -u "$work/expected.txt" "$work/merged.txt"; then
+    echo "$shards shards splitting the $split: ok"
+  else
+    echo "$shards shards splitting the $split: results differ" >&2
+    status=1
+  fi
+  rm -f "$work"/part*.txt
+done
+
+exit $status